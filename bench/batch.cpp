@@ -0,0 +1,51 @@
+//isAllowedValues on a column of int32 and int64 values, against calling
+//isAllowedValue on each, for a domain small enough to be broadcast and a
+//large one that is searched. Built plain and, where the compiler can, for
+//SSE4.1 and AVX2 (bench_batch_sse41, bench_batch_avx2).
+//usage: bench_batch [column size = 1000000]
+#include "bench.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <cstdio>
+
+template<class T>
+void run(const char* type, std::size_t size, std::size_t column) {
+    std::vector<int> random = bench::randomValues(size, static_cast<std::uint32_t>(2 * size));
+    VariableDomain<T, std::less<T>, FlatStorage> domain;
+    for(int value : random) {
+        domain.addAllowedValue(static_cast<T>(value));
+    }
+    std::vector<T> values;
+    for(int value : bench::randomValues(column, static_cast<std::uint32_t>(2 * size), 2)) {
+        values.push_back(static_cast<T>(value));
+    }
+    std::vector<std::uint64_t> bits((column + 63) / 64);
+
+    //The first call builds the sorted snapshot, outside of the timing
+    domain.isAllowedValues(values.data(), values.size(), bits.data());
+    double batch = bench::milliseconds([&] {
+        domain.isAllowedValues(values.data(), values.size(), bits.data());
+        bench::sink() += static_cast<std::size_t>(bits[0]);
+    }, 5);
+
+    double single = bench::milliseconds([&] {
+        std::size_t found = 0;
+        for(T value : values) {
+            found += domain.isAllowedValue(value);
+        }
+        bench::sink() += found;
+    }, 5);
+
+    double bytes = static_cast<double>(column * sizeof(T));
+    std::printf("%-6s domain=%-7zu batch %7.2f GB/s  one by one %7.2f GB/s\n", type, size,
+        bytes / batch / 1e6, bytes / single / 1e6);
+}
+
+int main(int argc, char** argv) {
+    std::size_t column = bench::sizeArgument(argc, argv, 1, 1000000);
+    for(std::size_t size : {8, 100000}) {
+        run<std::int32_t>("int32", size, column);
+        run<std::int64_t>("int64", size, column);
+    }
+}
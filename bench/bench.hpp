@@ -0,0 +1,54 @@
+#ifndef DRV_BENCH_HPP
+#define DRV_BENCH_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+//Helpers shared by the benchmarks. Each benchmark prints one line per
+//measurement, and takes its sizes from the command line where they matter.
+namespace bench {
+
+//Written to, so that the compiler keeps the results being measured
+inline volatile std::size_t& sink() {
+    static volatile std::size_t value = 0;
+    return value;
+}
+
+//Milliseconds f took, best of repeats
+template<class F>
+double milliseconds(F&& f, int repeats = 1) {
+    double best = 0.0;
+    for(int i = 0; i < repeats; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        double taken = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        if(i == 0 || taken < best) {
+            best = taken;
+        }
+    }
+    return best;
+}
+
+//n values drawn from [0, range)
+inline std::vector<int> randomValues(std::size_t n, std::uint32_t range, std::uint32_t seed = 1) {
+    std::mt19937 rng(seed);
+    std::vector<int> values(n);
+    for(int& value : values) {
+        value = static_cast<int>(rng() % range);
+    }
+    return values;
+}
+
+//argv[index] as a size, or fallback if it is missing
+inline std::size_t sizeArgument(int argc, char** argv, int index, std::size_t fallback) {
+    return argc > index ? static_cast<std::size_t>(std::strtoull(argv[index], nullptr, 10)) : fallback;
+}
+
+}
+
+#endif
@@ -0,0 +1,109 @@
+//Threads mixing lookups and changes at a fixed ratio, 99/1 and 90/10, for 1
+//to 64 threads: a ConcurrentStorage domain (shared lock), the same domain
+//read through snapshots (no lock), and a plain domain behind a std::mutex.
+//usage: bench_concurrent [most threads = 64] [values = 100000]
+#include "bench.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+const std::size_t operations_per_thread = 50000;
+
+//Runs operations_per_thread operations on each of threads threads, each of
+//them a change with probability write_percent / 100 and a lookup otherwise,
+//returning operations per microsecond. Changes add or remove one of 64
+//values outside of the looked up range. Best of three runs.
+template<class Read, class Change>
+double throughput(std::size_t threads, unsigned write_percent, Read read, Change change) {
+    std::vector<std::vector<int>> probes;
+    for(std::size_t t = 0; t < threads; ++t) {
+        probes.push_back(bench::randomValues(operations_per_thread, 200000,
+            static_cast<std::uint32_t>(t + 2)));
+    }
+    double taken = bench::milliseconds([&] {
+        std::vector<std::thread> running;
+        for(std::size_t t = 0; t < threads; ++t) {
+            running.emplace_back([&, t] {
+                std::mt19937 rng(static_cast<std::uint32_t>(t));
+                std::size_t found = 0;
+                for(int probe : probes[t]) {
+                    if(rng() % 100 < write_percent) {
+                        change(200000 + probe % 64, probe % 2 == 0);
+                    } else {
+                        found += read(probe);
+                    }
+                }
+                bench::sink() += found;
+            });
+        }
+        for(std::thread& thread : running) {
+            thread.join();
+        }
+    }, 3);
+    return threads * operations_per_thread / (1e3 * taken);
+}
+
+int main(int argc, char** argv) {
+    std::size_t most = bench::sizeArgument(argc, argv, 1, 64);
+    std::size_t n = bench::sizeArgument(argc, argv, 2, 100000);
+    std::vector<int> values = bench::randomValues(n, 200000);
+
+    VariableDomain<int, std::less<int>, ConcurrentStorage<>> shared;
+    shared.addAllowedValuesRange(values.begin(), values.end());
+    auto change_shared = [&](int value, bool add) {
+        if(add) {
+            shared.addAllowedValue(value);
+        } else {
+            shared.removeAllowedValue(value);
+        }
+    };
+
+    VariableDomain<int, std::less<int>, ConcurrentStorage<>> published;
+    published.addAllowedValuesRange(values.begin(), values.end());
+    published.enableSnapshots();
+    auto change_published = [&](int value, bool add) {
+        if(add) {
+            published.addAllowedValue(value);
+        } else {
+            published.removeAllowedValue(value);
+        }
+    };
+
+    VariableDomain<int> plain;
+    plain.addAllowedValuesRange(values.begin(), values.end());
+    std::mutex mutex;
+
+    std::printf("%zu values, operations per us\n", n);
+    std::printf("threads  mix    ConcurrentStorage  snapshots  std::mutex\n");
+    for(std::size_t threads = 1; threads <= most; threads *= 2) {
+        for(unsigned write_percent : {1u, 10u}) {
+            double locked = throughput(threads, write_percent, [&](int probe) {
+                return shared.isAllowedValue(probe);
+            }, change_shared);
+
+            //Each lookup takes a snapshot of its own, which costs no lock
+            double snapshots = throughput(threads, write_percent, [&](int probe) {
+                return published.snapshot().isAllowedValue(probe);
+            }, change_published);
+
+            double exclusive = throughput(threads, write_percent, [&](int probe) {
+                std::lock_guard<std::mutex> guard(mutex);
+                return plain.isAllowedValue(probe);
+            }, [&](int value, bool add) {
+                std::lock_guard<std::mutex> guard(mutex);
+                if(add) {
+                    plain.addAllowedValue(value);
+                } else {
+                    plain.removeAllowedValue(value);
+                }
+            });
+
+            std::printf("%-8zu %2u/%-2u  %17.2f  %9.2f  %10.2f\n", threads, 100 - write_percent,
+                write_percent, locked, snapshots, exclusive);
+        }
+    }
+}
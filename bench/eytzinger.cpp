@@ -0,0 +1,43 @@
+//Lookups with LookupAcceleration::eytzinger against plain ones and a bare
+//std::set::find, with 2M random probes, a quarter of them allowed.
+//usage: bench_eytzinger [largest size = 10000000]
+#include "bench.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <cstdio>
+#include <set>
+
+template<class Contains>
+void report(const char* name, std::size_t n, const std::vector<int>& probes, Contains contains) {
+    double taken = bench::milliseconds([&] {
+        std::size_t found = 0;
+        for(int probe : probes) {
+            found += contains(probe);
+        }
+        bench::sink() += found;
+    }, 3);
+    std::printf("%-10s n=%-9zu %8.1f ns\n", name, n, 1e6 * taken / probes.size());
+}
+
+int main(int argc, char** argv) {
+    std::size_t largest = bench::sizeArgument(argc, argv, 1, 10000000);
+    for(std::size_t n = 1000; n <= largest; n *= 100) {
+        std::uint32_t range = static_cast<std::uint32_t>(4 * n);
+        std::vector<int> values = bench::randomValues(n, range);
+        std::vector<int> probes = bench::randomValues(2000000, range, 2);
+
+        {
+            std::set<int> set(values.begin(), values.end());
+            report("std::set", n, probes, [&](int probe) { return set.find(probe) != set.end(); });
+        }
+
+        VariableDomain<int> domain;
+        domain.addAllowedValuesRange(values.begin(), values.end());
+        report("none", n, probes, [&](int probe) { return domain.isAllowedValue(probe); });
+        domain.setLookupAcceleration(LookupAcceleration::eytzinger);
+        //The index is built on the first lookup
+        domain.isAllowedValue(0);
+        report("eytzinger", n, probes, [&](int probe) { return domain.isAllowedValue(probe); });
+    }
+}
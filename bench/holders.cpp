@@ -0,0 +1,48 @@
+//What holding a value costs: copying and destroying a variable, growing a
+//std::vector of copies (which moves them), and how many allocations either
+//makes, counted with CountingAllocator. The domain holds 1000 values.
+//usage: bench_holders [copies = 1000000]
+#include "bench.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <cstdio>
+
+using allocator_type = CountingAllocator<int>;
+using domain_type = VariableDomain<int, std::less<int>, SetStorage, allocator_type>;
+using variable_type = DomainRestrictedVariable<int, std::less<int>, SetStorage, allocator_type>;
+
+int main(int argc, char** argv) {
+    std::size_t copies = bench::sizeArgument(argc, argv, 1, 1000000);
+
+    AllocationCounts counts = AllocationCounts();
+    domain_type domain((allocator_type(counts)));
+    for(int i = 0; i < 1000; ++i) {
+        domain.addAllowedValue(i);
+    }
+    variable_type source(domain, 500);
+
+    std::size_t before = counts.allocations;
+    double copy = bench::milliseconds([&] {
+        for(std::size_t i = 0; i < copies; ++i) {
+            variable_type copy(source);
+            bench::sink() += static_cast<std::size_t>(copy.value());
+        }
+    }, 3);
+    std::size_t copy_allocations = counts.allocations - before;
+
+    before = counts.allocations;
+    double growth = bench::milliseconds([&] {
+        std::vector<variable_type> variables;
+        for(std::size_t i = 0; i < copies; ++i) {
+            variables.push_back(source);
+        }
+        bench::sink() += variables.size();
+    });
+    std::size_t growth_allocations = counts.allocations - before;
+
+    std::printf("copy and destroy   %7.2f ns    domain allocations %zu\n",
+        1e6 * copy / copies, copy_allocations);
+    std::printf("vector of %zu copies %7.2f ms    domain allocations %zu\n",
+        copies, growth, growth_allocations);
+}
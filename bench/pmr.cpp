@@ -0,0 +1,91 @@
+//A short-lived domain of 50 std::pmr::string(s), one variable and a second
+//domain, built per "request" from a 64 KiB buffer on the stack, against the
+//same work on the global heap. Counts what reaches the arena's upstream and
+//the default resource, which both should never see.
+//usage: bench_pmr [requests = 100000]
+#include "bench.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <cstdio>
+#include <memory_resource>
+#include <string>
+
+//Forwards to another resource, counting the allocations
+class counting_resource: public std::pmr::memory_resource {
+    public:
+    explicit counting_resource(std::pmr::memory_resource* upstream):
+        m_upstream(upstream), m_allocations(0) {}
+
+    std::size_t allocations() const { return m_allocations; }
+
+    private:
+    std::pmr::memory_resource* m_upstream;
+    std::size_t m_allocations;
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        ++m_allocations;
+        return m_upstream->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
+        m_upstream->deallocate(ptr, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+//Long enough to defeat the small string optimization
+std::string valueName(std::size_t i) {
+    return "a-value-long-enough-for-the-heap-" + std::to_string(i);
+}
+
+template<class Storage>
+void run(const char* name, std::size_t requests) {
+    counting_resource upstream(std::pmr::new_delete_resource());
+    counting_resource fallback(std::pmr::new_delete_resource());
+    std::pmr::memory_resource* previous = std::pmr::set_default_resource(&fallback);
+
+    double arena = bench::milliseconds([&] {
+        for(std::size_t r = 0; r < requests; ++r) {
+            alignas(std::max_align_t) unsigned char buffer[65536];
+            std::pmr::monotonic_buffer_resource resource(buffer, sizeof(buffer), &upstream);
+            PmrVariableDomain<std::pmr::string, std::less<std::pmr::string>, Storage> domain(&resource);
+            for(std::size_t i = 0; i < 50; ++i) {
+                domain.addAllowedValue(std::pmr::string(valueName(i).c_str(), &resource));
+            }
+            PmrDomainRestrictedVariable<std::pmr::string, std::less<std::pmr::string>, Storage> variable(
+                domain, std::pmr::string(valueName(7).c_str(), &resource));
+            PmrVariableDomain<std::pmr::string, std::less<std::pmr::string>, Storage> other(&resource);
+            other.addAllowedValue(std::pmr::string(valueName(1).c_str(), &resource));
+            bench::sink() += variable.value().size() + other.isAllowedValue(variable.value());
+        }
+    });
+    std::pmr::set_default_resource(previous);
+
+    double heap = bench::milliseconds([&] {
+        for(std::size_t r = 0; r < requests; ++r) {
+            VariableDomain<std::string, std::less<std::string>, Storage> domain;
+            for(std::size_t i = 0; i < 50; ++i) {
+                domain.addAllowedValue(valueName(i));
+            }
+            DomainRestrictedVariable<std::string, std::less<std::string>, Storage> variable(
+                domain, valueName(7));
+            VariableDomain<std::string, std::less<std::string>, Storage> other;
+            other.addAllowedValue(valueName(1));
+            bench::sink() += variable.value().size() + other.isAllowedValue(variable.value());
+        }
+    });
+
+    std::printf("%-12s arena %7.2f us/request  heap %7.2f us/request  "
+        "upstream allocations %zu  default resource allocations %zu\n",
+        name, 1e3 * arena / requests, 1e3 * heap / requests,
+        upstream.allocations(), fallback.allocations());
+}
+
+int main(int argc, char** argv) {
+    std::size_t requests = bench::sizeArgument(argc, argv, 1, 100000);
+    run<SetStorage>("SetStorage", requests);
+    run<FlatStorage>("FlatStorage", requests);
+    run<HashStorage<>>("HashStorage", requests);
+}
@@ -0,0 +1,61 @@
+//Replacing a value held by n shuffled variables, from 1K to the largest
+//count: onto a new value, which retargets their holder list without
+//visiting them, and onto a value that is held too, which merges the smaller
+//list into the larger one and so visits only the variables of the smaller.
+//usage: bench_replace [largest holder count = 4194304]
+#include "bench.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+
+using variable_ptr = std::unique_ptr<DomainRestrictedVariable<int>>;
+
+//n variables holding value, allocated one by one and shuffled, so that
+//neighbours in a holder list are far apart in memory
+void hold(VariableDomain<int>& domain, int value, std::size_t n, std::vector<variable_ptr>& variables) {
+    std::size_t first = variables.size();
+    for(std::size_t i = 0; i < n; ++i) {
+        variables.emplace_back(new DomainRestrictedVariable<int>(domain, value));
+    }
+    std::shuffle(variables.begin() + static_cast<std::ptrdiff_t>(first), variables.end(),
+        std::mt19937(static_cast<std::uint32_t>(value)));
+}
+
+void run(std::size_t n) {
+    //1 and 2 are held by n variables each, 3 and 4 by one
+    VariableDomain<int> domain{1, 2, 3, 4};
+    std::vector<variable_ptr> variables;
+    hold(domain, 1, n, variables);
+    hold(domain, 2, n, variables);
+    hold(domain, 3, 1, variables);
+    hold(domain, 4, 1, variables);
+
+    double retarget = bench::milliseconds([&] {
+        domain.replaceAllowedValue(1, 5);
+        domain.replaceAllowedValue(5, 1);
+    }, 5) / 2;
+    //Merges cannot be undone, so each of them is timed once
+    double small_into_large = bench::milliseconds([&] {
+        domain.replaceAllowedValue(3, 1);
+    });
+    double large_into_small = bench::milliseconds([&] {
+        domain.replaceAllowedValue(1, 4);
+    });
+    double equal = bench::milliseconds([&] {
+        domain.replaceAllowedValue(2, 4);
+    });
+    bench::sink() += domain.useCount(4);
+
+    std::printf("n=%-8zu retarget %9.4f ms  merge 1 into n %9.4f ms  n into 1 %9.4f ms"
+        "  n into n %9.4f ms\n", n, retarget, small_into_large, large_into_small, equal);
+}
+
+int main(int argc, char** argv) {
+    std::size_t largest = bench::sizeArgument(argc, argv, 1, 4194304);
+    for(std::size_t n = 1024; n <= largest; n *= 4) {
+        run(n);
+    }
+}
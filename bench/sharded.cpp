@@ -0,0 +1,66 @@
+//Threads inserting distinct values at once, into one ConcurrentStorage
+//domain and into ShardedVariableDomain(s) of a few shard counts, one at a
+//time and through the range version.
+//usage: bench_sharded [threads = hardware threads] [values per thread = 200000]
+#include "bench.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+//Runs insert(values) on each thread with values of its own, returning
+//inserts per microsecond
+template<class Insert>
+double throughput(std::size_t threads, std::size_t per_thread, Insert insert) {
+    std::vector<std::vector<int>> values(threads);
+    for(std::size_t t = 0; t < threads; ++t) {
+        for(std::size_t i = 0; i < per_thread; ++i) {
+            values[t].push_back(static_cast<int>(i * threads + t));
+        }
+        std::shuffle(values[t].begin(), values[t].end(), std::mt19937(static_cast<std::uint32_t>(t)));
+    }
+    double taken = bench::milliseconds([&] {
+        std::vector<std::thread> workers;
+        for(std::size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] { insert(values[t]); });
+        }
+        for(std::thread& worker : workers) {
+            worker.join();
+        }
+    });
+    return threads * per_thread / (1e3 * taken);
+}
+
+int main(int argc, char** argv) {
+    std::size_t threads = bench::sizeArgument(argc, argv, 1,
+        std::max<std::size_t>(1, std::thread::hardware_concurrency()));
+    std::size_t per_thread = bench::sizeArgument(argc, argv, 2, 200000);
+    std::printf("%zu threads, %zu values each, inserts per us:\n", threads, per_thread);
+
+    {
+        VariableDomain<int, std::less<int>, ConcurrentStorage<>> domain;
+        double single = throughput(threads, per_thread, [&](const std::vector<int>& values) {
+            for(int value : values) {
+                domain.addAllowedValue(value);
+            }
+        });
+        std::printf("one domain                %8.2f\n", single);
+    }
+
+    for(std::size_t shards : {4, 16, 64}) {
+        ShardedVariableDomain<int> domain(shards);
+        double single = throughput(threads, per_thread, [&](const std::vector<int>& values) {
+            for(int value : values) {
+                domain.addAllowedValue(value);
+            }
+        });
+        ShardedVariableDomain<int> ranged(shards);
+        double range = throughput(threads, per_thread, [&](const std::vector<int>& values) {
+            ranged.addAllowedValuesRange(values.begin(), values.end());
+        });
+        std::printf("%2zu shards, one by one    %8.2f\n", shards, single);
+        std::printf("%2zu shards, as a range    %8.2f\n", shards, range);
+    }
+}
@@ -0,0 +1,51 @@
+//SetStorage against FlatStorage: building a domain one value at a time,
+//checking random values, half of them allowed, and assigning a variable
+//random allowed values.
+//usage: bench_storage [largest size = 100000]
+#include "bench.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <cstdio>
+
+template<class Storage>
+void run(const char* name, const std::vector<int>& values, const std::vector<int>& probes) {
+    VariableDomain<int, std::less<int>, Storage> domain;
+    double build = bench::milliseconds([&] {
+        for(int value : values) {
+            domain.addAllowedValue(value);
+        }
+    });
+
+    double lookup = bench::milliseconds([&] {
+        std::size_t found = 0;
+        for(int probe : probes) {
+            found += domain.isAllowedValue(probe);
+        }
+        bench::sink() += found;
+    }, 3);
+
+    //Every assignment checks the new value against the domain
+    DomainRestrictedVariable<int, std::less<int>, Storage> variable(domain, values[0]);
+    double assign = bench::milliseconds([&] {
+        for(std::size_t i = 0; i < probes.size(); ++i) {
+            variable = values[probes[i] % values.size()];
+        }
+        bench::sink() += static_cast<std::size_t>(variable.value());
+    }, 3);
+
+    std::printf("%-12s n=%-9zu build %9.2f ns/value  lookup %7.2f ns  assign %7.2f ns\n", name,
+        values.size(), 1e6 * build / values.size(), 1e6 * lookup / probes.size(),
+        1e6 * assign / probes.size());
+}
+
+int main(int argc, char** argv) {
+    std::size_t largest = bench::sizeArgument(argc, argv, 1, 100000);
+    for(std::size_t n = 16; n <= largest; n *= 8) {
+        std::uint32_t range = static_cast<std::uint32_t>(2 * n);
+        std::vector<int> values = bench::randomValues(n, range);
+        std::vector<int> probes = bench::randomValues(1000000, range, 2);
+        run<SetStorage>("SetStorage", values, probes);
+        run<FlatStorage>("FlatStorage", values, probes);
+    }
+}
@@ -1,558 +1,6833 @@
 #ifndef DOMAIN_RESTRICTED_VARIABLE_HPP
 #define DOMAIN_RESTRICTED_VARIABLE_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <initializer_list>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <new>
 #include <set>
 #include <stdexcept>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
-template<class value_type, class Compare = std::less<value_type>>
-class DomainRestrictedVariable;
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#include <optional>
+#include <shared_mutex>
+#include <string_view>
+#endif
 
-template<class value_type, class Compare = std::less<value_type>>
-class VariableDomain {
-    friend class DomainRestrictedVariable<value_type, Compare>;
-    using storage_type = std::set<value_type, Compare>;
+#if __cplusplus >= 202002L
+#include <span>
+#endif
 
-    public:
-    using const_iterator = typename storage_type::const_iterator;
-    using const_reverse_iterator = typename storage_type::const_reverse_iterator;
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
 
-    VariableDomain(
-        std::initializer_list<value_type> ilist = {},
-        const Compare& comp = Compare()
-    );
-    explicit VariableDomain(
-        const Compare& comp
-    );
-    template<class InputIt>
-    VariableDomain(
-        InputIt first, InputIt last,
-        const Compare& comp = Compare()
-    );
+//The hash the ordered storages give a frozen domain, which has to agree
+//with Compare: values Compare finds equivalent must hash alike. std::hash
+//is used for std::less and std::greater; specialize this with a `type`
+//member for other comparators, such as case-insensitive ones:
+//
+//  template<> struct CompareHash<std::string, CaseInsensitiveLess> {
+//      using type = CaseInsensitiveHash;
+//  };
+template<class value_type, class Compare>
+struct CompareHash {};
 
-    VariableDomain(const VariableDomain& other) = delete;
-    VariableDomain(VariableDomain&& other) = default;
+namespace drv_detail {
 
-    VariableDomain& operator=(const VariableDomain& other) = delete;
-    VariableDomain& operator=(VariableDomain&& other) = delete;
+template<class Compare, class = void>
+struct is_transparent: std::false_type {};
 
-    ~VariableDomain() noexcept(false);
+template<class Compare>
+struct is_transparent<Compare, decltype(void(sizeof(typename Compare::is_transparent*)))>:
+    std::true_type {};
 
-    //Iterator
-    const_iterator begin() const;
-    const_iterator cbegin() const;
-    const_iterator end() const;
-    const_iterator cend() const;
-    const_reverse_iterator rbegin() const;
-    const_reverse_iterator crbegin() const;
-    const_reverse_iterator rend() const;
-    const_reverse_iterator crend() const;
+template<class T, class = void>
+struct is_hashable: std::false_type {};
 
-    //Check
-    bool isAllowedValue(const value_type& value) const;
-#if __cplusplus >= 201402L
+template<class T>
+struct is_hashable<T, decltype(void(std::declval<const std::hash<T>&>()(std::declval<const T&>())))>:
+    std::true_type {};
+
+//Stands in for std::hash where it is not specialized, so such types can
+//still be stored; freezing their domains is refused at compile time
+struct unhashable {
     template<class K>
-    bool isAllowedValue(K&& x) const;
+    std::size_t operator()(const K&) const { return 0; }
+};
+
+//std::hash<T> if it exists, unhashable otherwise
+template<class T>
+using hash_or_unhashable = typename std::conditional<
+    is_hashable<T>::value, std::hash<T>, unhashable>::type;
+
+//Comparators under which equivalent values are equal, so std::hash agrees
+template<class T, class Compare>
+struct is_natural_order: std::false_type {};
+
+template<class T>
+struct is_natural_order<T, std::less<T>>: std::true_type {};
+
+template<class T>
+struct is_natural_order<T, std::greater<T>>: std::true_type {};
+
+#if __cplusplus >= 201402L
+template<class T>
+struct is_natural_order<T, std::less<>>: std::true_type {};
+
+template<class T>
+struct is_natural_order<T, std::greater<>>: std::true_type {};
 #endif
 
-    //Addition
-    bool addAllowedValue(const value_type& value);
-    bool addAllowedValue(value_type&& value);
-    template<class InputIt>
-    void addAllowedValuesRange(InputIt first, InputIt last);
-    void addAllowedValues(std::initializer_list<value_type> ilist);
+//CompareHash<T, Compare>::type if specialized, else std::hash for natural
+//orders, else unhashable
+template<class T, class Compare, class = void>
+struct compare_hash {
+    using type = typename std::conditional<
+        is_natural_order<T, Compare>::value, hash_or_unhashable<T>, unhashable>::type;
+};
 
-    template<class... Args>
-    bool emplaceAllowedValue(Args&&... args);
+template<class T, class Compare>
+struct compare_hash<T, Compare, decltype(void(sizeof(typename CompareHash<T, Compare>::type*)))> {
+    using type = typename CompareHash<T, Compare>::type;
+};
 
-    //Removal
-    bool removeAllowedValue(const value_type& value);
-    void removeAllowedValues(std::initializer_list<value_type> ilist);
+//Allocator, rebound to allocate T
+template<class Allocator, class T>
+using rebind_alloc = typename std::allocator_traits<Allocator>::template rebind_alloc<T>;
 
-    //Replacement
-    bool replaceAllowedValue(
-        const value_type& to_replace,
-        const value_type& replacement
-    );
-    bool replaceAllowedValue(
-        const value_type& to_replace,
-        value_type&& value
-    );
+//Storages whose values are fixed at compile time declare `fixed`, and the
+//VariableDomain holding them starts, and stays, frozen
+template<class Storage, class = void>
+struct is_fixed: std::false_type {};
 
-    //Retrieval
-    std::vector<value_type> allowedValues() const;
+template<class Storage>
+struct is_fixed<Storage, typename std::enable_if<Storage::fixed>::type>: std::true_type {};
+
+//Storages that keep ranges rather than values declare `materialized`: they
+//only give a value an address once something asks for one. Membership
+//checks then go through their contains(), and freezing builds no perfect
+//hash, as iterating over them yields copies.
+template<class Storage, class = void>
+struct is_materialized: std::false_type {};
+
+template<class Storage>
+struct is_materialized<Storage, typename std::enable_if<Storage::materialized>::type>:
+    std::true_type {};
+
+//Storages that declare `concurrent` make their VariableDomain lock itself,
+//see ConcurrentStorage
+template<class Storage, class = void>
+struct is_concurrent: std::false_type {};
+
+template<class Storage>
+struct is_concurrent<Storage, typename std::enable_if<Storage::concurrent>::type>:
+    std::true_type {};
+
+template<class T, T... values>
+struct static_values;
+
+template<class T>
+struct static_values<T> {
+    static constexpr bool contains(T) { return false; }
+    static constexpr bool ascending(T) { return true; }
+};
+
+template<class T, T first, T... rest>
+struct static_values<T, first, rest...> {
+    static constexpr bool contains(T value) {
+        return value == first || static_values<T, rest...>::contains(value);
+    }
+    static constexpr bool ascending(T previous) {
+        return previous < first && static_values<T, rest...>::ascending(first);
+    }
+    static constexpr bool ascending() {
+        return static_values<T, rest...>::ascending(first);
+    }
+};
+
+inline unsigned count_trailing_zeros(std::uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(word));
+#else
+    unsigned count = 0;
+    for(; (word & 1) == 0; word >>= 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+inline unsigned count_leading_zeros(std::uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_clzll(word));
+#else
+    unsigned count = 0;
+    for(; (word & (UINT64_C(1) << 63)) == 0; word <<= 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+inline std::size_t popcount(std::uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<std::size_t>(__builtin_popcountll(word));
+#else
+    std::size_t count = 0;
+    for(; word != 0; word &= word - 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+//Whether key lies in [Min, Max], compared in the key's own signedness so
+//that keys wider than the window's type are not truncated into it
+template<long long Min, long long Max, class K>
+bool in_window(K key, std::true_type) {
+    return static_cast<long long>(key) >= Min && static_cast<long long>(key) <= Max;
+}
+
+template<long long Min, long long Max, class K>
+bool in_window(K key, std::false_type) {
+    return Max >= 0 && static_cast<unsigned long long>(key) <= static_cast<unsigned long long>(Max)
+        && (Min <= 0 || static_cast<unsigned long long>(key) >= static_cast<unsigned long long>(Min));
+}
+
+//Walks the set bits of a bitset, yielding the matching entries of a table
+//holding one value per bit
+template<class T>
+class bitset_iterator {
+    public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T*;
+    using reference = const T&;
+
+    bitset_iterator(): m_words(nullptr), m_values(nullptr), m_bits(0), m_index(0) {}
+    bitset_iterator(
+        const std::uint64_t* words, const T* values,
+        std::size_t bits, std::size_t index
+    ): m_words(words), m_values(values), m_bits(bits), m_index(index) {}
+
+    reference operator*() const { return m_values[m_index]; }
+    pointer operator->() const { return m_values + m_index; }
+
+    bitset_iterator& operator++() { m_index = next(m_index + 1); return *this; }
+    bitset_iterator operator++(int) { bitset_iterator tmp(*this); ++*this; return tmp; }
+    bitset_iterator& operator--() { m_index = previous(m_index); return *this; }
+    bitset_iterator operator--(int) { bitset_iterator tmp(*this); --*this; return tmp; }
+
+    friend bool operator==(const bitset_iterator& lhs, const bitset_iterator& rhs) {
+        return lhs.m_index == rhs.m_index;
+    }
+    friend bool operator!=(const bitset_iterator& lhs, const bitset_iterator& rhs) {
+        return lhs.m_index != rhs.m_index;
+    }
+
+    //First set bit at or after index, or the bit count if there is none
+    std::size_t next(std::size_t index) const;
+    //Last set bit before index
+    std::size_t previous(std::size_t index) const;
 
     private:
-    storage_type m_allowed_values;
+    const std::uint64_t* m_words;
+    const T* m_values;
+    std::size_t m_bits;
+    std::size_t m_index;
+};
 
-    std::set<
-        DomainRestrictedVariable<value_type, Compare>*> m_managed_variables;
+template<class T>
+std::size_t bitset_iterator<T>::next(std::size_t index) const {
+    if(index >= m_bits) {
+        return m_bits;
+    }
+
+    std::size_t word = index / 64;
+    std::uint64_t bits = m_words[word] & (~UINT64_C(0) << (index % 64));
+    while(bits == 0) {
+        if(++word * 64 >= m_bits) {
+            return m_bits;
+        }
+        bits = m_words[word];
+    }
+    return word * 64 + count_trailing_zeros(bits);
+}
 
-    void subscribeVariable(
-        const DomainRestrictedVariable<value_type, Compare>* const ptr);
-    void unsubscribeVariable(
-        const DomainRestrictedVariable<value_type, Compare>* const ptr);
+template<class T>
+std::size_t bitset_iterator<T>::previous(std::size_t index) const {
+    std::size_t word = (index - 1) / 64;
+    std::uint64_t bits = m_words[word] & (~UINT64_C(0) >> (63 - (index - 1) % 64));
+    while(bits == 0) {
+        bits = m_words[--word];
+    }
+    return word * 64 + 63 - count_leading_zeros(bits);
+}
+
+//Walks a sequence of pointers as if it were the sequence of pointed-to values
+template<class T, class BaseIt>
+class indirect_iterator {
+    public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T*;
+    using reference = const T&;
+
+    indirect_iterator(): m_it() {}
+    explicit indirect_iterator(BaseIt it): m_it(it) {}
+
+    reference operator*() const { return **m_it; }
+    pointer operator->() const { return *m_it; }
+
+    indirect_iterator& operator++() { ++m_it; return *this; }
+    indirect_iterator operator++(int) { indirect_iterator tmp(*this); ++m_it; return tmp; }
+    indirect_iterator& operator--() { --m_it; return *this; }
+    indirect_iterator operator--(int) { indirect_iterator tmp(*this); --m_it; return tmp; }
+
+    friend bool operator==(const indirect_iterator& lhs, const indirect_iterator& rhs) {
+        return lhs.m_it == rhs.m_it;
+    }
+    friend bool operator!=(const indirect_iterator& lhs, const indirect_iterator& rhs) {
+        return lhs.m_it != rhs.m_it;
+    }
 
-    void deletionNotice(value_type* to_delete);
-    void replacementNotice(value_type* to_replace, value_type* replacement);
+    private:
+    BaseIt m_it;
 };
 
-template<class value_type, class Compare>
-class DomainRestrictedVariable {
+//Walks every value of a sequence of disjoint closed intervals, given as
+//parallel arrays of starts and ends. Values are produced, not stored, so
+//dereferencing yields a copy.
+template<class T>
+class interval_iterator {
     public:
-    DomainRestrictedVariable(
-        VariableDomain<value_type, Compare>& domain,
-        const value_type& value
-    );
-    DomainRestrictedVariable(
-        VariableDomain<value_type, Compare>& domain
-    );
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T*;
+    using reference = T;
 
-    DomainRestrictedVariable(const DomainRestrictedVariable& other);
-    DomainRestrictedVariable(DomainRestrictedVariable&& other);
+    interval_iterator(): m_starts(nullptr), m_ends(nullptr), m_count(0), m_index(0), m_value() {}
+    interval_iterator(
+        const T* starts, const T* ends,
+        std::size_t count, std::size_t index
+    ): m_starts(starts), m_ends(ends), m_count(count), m_index(index),
+        m_value(index < count ? starts[index] : T()) {}
 
-    ~DomainRestrictedVariable();
+    reference operator*() const { return m_value; }
+    pointer operator->() const { return &m_value; }
 
-    DomainRestrictedVariable& operator=(const DomainRestrictedVariable& other);
-    DomainRestrictedVariable& operator=(DomainRestrictedVariable&& other);
-    DomainRestrictedVariable& operator=(const value_type& value);
+    interval_iterator& operator++();
+    interval_iterator operator++(int) { interval_iterator tmp(*this); ++*this; return tmp; }
+    interval_iterator& operator--();
+    interval_iterator operator--(int) { interval_iterator tmp(*this); --*this; return tmp; }
 
-    void clear();
-    bool has_value() const;
+    friend bool operator==(const interval_iterator& lhs, const interval_iterator& rhs) {
+        return lhs.m_index == rhs.m_index && (lhs.m_index == lhs.m_count || lhs.m_value == rhs.m_value);
+    }
+    friend bool operator!=(const interval_iterator& lhs, const interval_iterator& rhs) {
+        return !(lhs == rhs);
+    }
 
-    const value_type& value() const;
+    private:
+    const T* m_starts;
+    const T* m_ends;
+    std::size_t m_count;
+    std::size_t m_index;
+    T m_value;
+};
 
-    //WARNING:  If the variable is uninitialized or cleared
-    //          this method has undefined behaviour
-    operator const value_type&() const;
+template<class T>
+interval_iterator<T>& interval_iterator<T>::operator++() {
+    if(m_value == m_ends[m_index]) {
+        if(++m_index < m_count) {
+            m_value = m_starts[m_index];
+        }
+    } else {
+        ++m_value;
+    }
+    return *this;
+}
 
-    friend bool operator==(
-        const DomainRestrictedVariable<value_type, Compare>& lhs,
-        const DomainRestrictedVariable<value_type, Compare>& rhs
-    );
+template<class T>
+interval_iterator<T>& interval_iterator<T>::operator--() {
+    if(m_index == m_count || m_value == m_starts[m_index]) {
+        m_value = m_ends[--m_index];
+    } else {
+        --m_value;
+    }
+    return *this;
+}
 
-    friend bool operator!=(
-        const DomainRestrictedVariable<value_type, Compare>& lhs,
-        const DomainRestrictedVariable<value_type, Compare>& rhs
-    );
+//Walks the occupied entries of an array of at most 64 slots, marked by a
+//bitmask, then the values of a second range
+template<class T, class SpillIt>
+class small_iterator {
+    public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T*;
+    using reference = const T&;
 
-    friend bool operator<(
-        const DomainRestrictedVariable<value_type, Compare>& lhs,
-        const DomainRestrictedVariable<value_type, Compare>& rhs
-    );
+    small_iterator(): m_slots(nullptr), m_occupied(0), m_count(0), m_index(0), m_spill(), m_spill_begin() {}
+    small_iterator(
+        const T* slots, std::uint64_t occupied, std::size_t count,
+        std::size_t index, SpillIt spill, SpillIt spill_begin
+    ): m_slots(slots), m_occupied(occupied), m_count(count), m_index(index),
+        m_spill(spill), m_spill_begin(spill_begin) {}
 
-    friend bool operator>(
-        const DomainRestrictedVariable<value_type, Compare>& lhs,
-        const DomainRestrictedVariable<value_type, Compare>& rhs
-    );
+    reference operator*() const { return m_index < m_count ? m_slots[m_index] : *m_spill; }
+    pointer operator->() const { return &**this; }
 
-    friend bool operator<=(
-        const DomainRestrictedVariable<value_type, Compare>& lhs,
-        const DomainRestrictedVariable<value_type, Compare>& rhs
-    );
+    small_iterator& operator++();
+    small_iterator operator++(int) { small_iterator tmp(*this); ++*this; return tmp; }
+    small_iterator& operator--();
+    small_iterator operator--(int) { small_iterator tmp(*this); --*this; return tmp; }
 
-    friend bool operator>=(
-        const DomainRestrictedVariable<value_type, Compare>& lhs,
-        const DomainRestrictedVariable<value_type, Compare>& rhs
-    );
+    friend bool operator==(const small_iterator& lhs, const small_iterator& rhs) {
+        return lhs.m_index == rhs.m_index && (lhs.m_index < lhs.m_count || lhs.m_spill == rhs.m_spill);
+    }
+    friend bool operator!=(const small_iterator& lhs, const small_iterator& rhs) {
+        return !(lhs == rhs);
+    }
+
+    //First occupied slot at or after index, or the slot count if there is none
+    std::size_t next(std::size_t index) const;
 
     private:
-    std::reference_wrapper<VariableDomain<value_type, Compare>> m_domain;
-    value_type* m_value;
+    const T* m_slots;
+    std::uint64_t m_occupied;
+    std::size_t m_count;
+    //m_count once past the slots, into the second range
+    std::size_t m_index;
+    SpillIt m_spill;
+    SpillIt m_spill_begin;
+};
+
+template<class T, class SpillIt>
+small_iterator<T, SpillIt>& small_iterator<T, SpillIt>::operator++() {
+    if(m_index < m_count) {
+        m_index = next(m_index + 1);
+    } else {
+        ++m_spill;
+    }
+    return *this;
+}
+
+template<class T, class SpillIt>
+small_iterator<T, SpillIt>& small_iterator<T, SpillIt>::operator--() {
+    if(m_index == m_count && m_spill != m_spill_begin) {
+        --m_spill;
+    } else {
+        m_index = 63 - count_leading_zeros(m_occupied & ((UINT64_C(1) << m_index) - 1));
+    }
+    return *this;
+}
+
+template<class T, class SpillIt>
+std::size_t small_iterator<T, SpillIt>::next(std::size_t index) const {
+    std::uint64_t rest = index < 64 ? m_occupied >> index << index : 0;
+    return rest == 0 ? m_count : count_trailing_zeros(rest);
+}
+
+//A node of an intrusive, circular doubly-linked list. A list is a hook that
+//stands for its head and is linked to itself while empty. Copies start out
+//unlinked. Linking a node next to another one does not change what the
+//other one is, so the links are mutable.
+struct list_hook {
+    mutable list_hook* prev;
+    mutable list_hook* next;
+
+    list_hook() noexcept: prev(this), next(this) {}
+    list_hook(const list_hook&) noexcept: prev(this), next(this) {}
+    list_hook& operator=(const list_hook&) = delete;
 
-    void deletionNotice(value_type* to_delete);
-    void replacementNotice(value_type* to_replace, value_type* replacement);
+    bool empty() const noexcept { return next == this; }
+
+    //Links this unlinked node in right before pos
+    void link_before(list_hook* pos) noexcept {
+        prev = pos->prev;
+        next = pos;
+        pos->prev->next = this;
+        pos->prev = this;
+    }
+    void unlink() noexcept {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = this;
+    }
+    //Moves every node of the list headed by other to the end of this one
+    void splice(list_hook& other) noexcept {
+        if(other.empty()) {
+            return;
+        }
+        other.next->prev = prev;
+        other.prev->next = this;
+        prev->next = other.next;
+        prev = other.prev;
+        other.prev = other.next = &other;
+    }
 };
 
+//A list_hook heading a list, with the number of nodes linked into it, kept
+//by whoever links and unlinks them
+struct counted_list: list_hook {
+    std::size_t count;
 
-template<class value_type, class Compare>
-VariableDomain<value_type, Compare>::VariableDomain(
-    std::initializer_list<value_type> ilist,
-    const Compare& comp
-): m_allowed_values(ilist, comp), m_managed_variables() {}
+    counted_list() noexcept: list_hook(), count(0) {}
+    counted_list(const counted_list&) noexcept: list_hook(), count(0) {}
+    counted_list& operator=(const counted_list&) = delete;
 
-template<class value_type, class Compare>
-VariableDomain<value_type, Compare>::VariableDomain(
-    const Compare& comp
-): m_allowed_values(comp), m_managed_variables() {}
+    void splice(counted_list& other) noexcept {
+        list_hook::splice(other);
+        count += other.count;
+        other.count = 0;
+    }
+};
 
-template<class value_type, class Compare>
-template<class InputIt>
-VariableDomain<value_type, Compare>::VariableDomain(
-    InputIt first, InputIt last,
-    const Compare& comp
-): m_allowed_values(first, last, comp), m_managed_variables() {}
+//The variables holding one value of a domain. They read the value from here,
+//so that the domain can replace it for all of them at once
+template<class T>
+struct holder_list: counted_list {
+    //Null for the variables holding no value, and for a list whose value
+    //left the domain, which lives on until its last variable leaves it
+    const T* value;
 
-template<class value_type, class Compare>
-VariableDomain<value_type, Compare>::~VariableDomain() noexcept(false) {
-    if(!m_managed_variables.empty()) {
-        throw std::logic_error(
-            "Cannot destroy a VariableDomain if DomainRestrictedVariable(s) depend on it.");
+    explicit holder_list(const T* held) noexcept: counted_list(), value(held) {}
+};
+
+//Orders pairs of an address and something else by the address, then by the
+//rest; std::less keeps addresses of unrelated objects ordered too
+struct address_pair_less {
+    template<class Pair>
+    bool operator()(const Pair& lhs, const Pair& rhs) const {
+        if(lhs.first != rhs.first) {
+            return std::less<typename Pair::first_type>()(lhs.first, rhs.first);
+        }
+        return std::less<typename Pair::second_type>()(lhs.second, rhs.second);
+    }
+};
+
+//The lock of a VariableDomain, which does nothing unless the domain is
+//concurrent
+template<bool concurrent>
+struct domain_mutex {
+    void lock() noexcept {}
+    void unlock() noexcept {}
+    void lock_shared() noexcept {}
+    void unlock_shared() noexcept {}
+};
+
+#if __cplusplus >= 201703L
+//Moving a domain is not thread-safe anyway, so the moved-to domain simply
+//gets a lock of its own
+template<>
+class domain_mutex<true> {
+    public:
+    domain_mutex() {}
+    domain_mutex(domain_mutex&&) {}
+
+    void lock() { m_mutex.lock(); }
+    void unlock() { m_mutex.unlock(); }
+    void lock_shared() { m_mutex.lock_shared(); }
+    void unlock_shared() { m_mutex.unlock_shared(); }
+
+    private:
+    std::shared_mutex m_mutex;
+};
+#endif
+
+template<class Mutex>
+class exclusive_guard {
+    public:
+    explicit exclusive_guard(Mutex& mutex): m_mutex(mutex) { m_mutex.lock(); }
+    exclusive_guard(const exclusive_guard&) = delete;
+    exclusive_guard& operator=(const exclusive_guard&) = delete;
+    ~exclusive_guard() { m_mutex.unlock(); }
+
+    private:
+    Mutex& m_mutex;
+};
+
+template<class Mutex>
+class shared_guard {
+    public:
+    explicit shared_guard(Mutex& mutex): m_mutex(mutex) { m_mutex.lock_shared(); }
+    shared_guard(const shared_guard&) = delete;
+    shared_guard& operator=(const shared_guard&) = delete;
+    ~shared_guard() { m_mutex.unlock_shared(); }
+
+    private:
+    Mutex& m_mutex;
+};
+
+//Holds the mutex for a lookup: shared, unless stale() says, once the shared
+//lock is taken, that the lookup would rebuild one of the lazily built
+//structures of the domain. Rebuilding is a write, so the lookup then holds
+//the mutex exclusively. The rebuilt structure stays fresh until the next
+//change, which needs the exclusive lock too.
+template<class Mutex>
+class read_guard {
+    public:
+    template<class Stale>
+    read_guard(Mutex& mutex, Stale stale): m_mutex(mutex), m_exclusive(false) {
+        m_mutex.lock_shared();
+        if(stale()) {
+            m_mutex.unlock_shared();
+            m_mutex.lock();
+            m_exclusive = true;
+        }
+    }
+    read_guard(const read_guard&) = delete;
+    read_guard& operator=(const read_guard&) = delete;
+    ~read_guard() {
+        if(m_exclusive) {
+            m_mutex.unlock();
+        } else {
+            m_mutex.unlock_shared();
+        }
+    }
+
+    private:
+    Mutex& m_mutex;
+    bool m_exclusive;
+};
+
+template<>
+class read_guard<domain_mutex<false>> {
+    public:
+    template<class Stale>
+    read_guard(domain_mutex<false>&, Stale) {}
+};
+
+//The generation slots of a VariableDomain, which threads can read without
+//the domain's lock while its holder adds more: slots live in chunks that
+//never move, chunk k holding 64 << k of them, and their fields are atomic.
+//Slots are added and changed by one thread at a time.
+template<class T, class Allocator>
+class slot_table {
+    public:
+    struct slot {
+        //Null while the slot is free
+        std::atomic<const T*> value;
+        //Bumped whenever the value leaves the domain
+        std::atomic<std::uint64_t> generation;
+    };
+
+    explicit slot_table(const Allocator& alloc);
+    slot_table(slot_table&& other) noexcept;
+    slot_table& operator=(const slot_table&) = delete;
+    ~slot_table();
+
+    std::size_t size() const noexcept { return m_size; }
+    slot& operator[](std::size_t index) const noexcept;
+
+    //Appends a free slot at generation one
+    void push_back();
+    void pop_back() noexcept { --m_size; }
+
+    private:
+    using slot_allocator = rebind_alloc<Allocator, slot>;
+
+    static const std::size_t first_chunk = 64;
+    //A little over 2^32 slots
+    static const std::size_t max_chunks = 27;
+
+    slot_allocator m_alloc;
+    std::atomic<slot*> m_chunks[max_chunks];
+    std::size_t m_size;
+
+    static std::size_t chunkOf(std::size_t index, std::size_t& offset) noexcept;
+};
+
+template<class T, class Allocator>
+slot_table<T, Allocator>::slot_table(const Allocator& alloc): m_alloc(alloc), m_size(0) {
+    for(std::atomic<slot*>& chunk : m_chunks) {
+        chunk.store(nullptr, std::memory_order_relaxed);
     }
 }
 
-template<class value_type, class Compare>
-typename VariableDomain<value_type, Compare>::const_iterator
-    VariableDomain<value_type, Compare>::begin() const
+template<class T, class Allocator>
+slot_table<T, Allocator>::slot_table(slot_table&& other) noexcept:
+    m_alloc(other.m_alloc), m_size(other.m_size)
 {
-    return m_allowed_values.begin();
+    for(std::size_t k = 0; k < max_chunks; ++k) {
+        m_chunks[k].store(other.m_chunks[k].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        other.m_chunks[k].store(nullptr, std::memory_order_relaxed);
+    }
+    other.m_size = 0;
+}
+
+template<class T, class Allocator>
+slot_table<T, Allocator>::~slot_table() {
+    for(std::size_t k = 0; k < max_chunks; ++k) {
+        slot* chunk = m_chunks[k].load(std::memory_order_relaxed);
+        if(chunk == nullptr) {
+            continue;
+        }
+        for(std::size_t i = 0; i < (first_chunk << k); ++i) {
+            std::allocator_traits<slot_allocator>::destroy(m_alloc, chunk + i);
+        }
+        std::allocator_traits<slot_allocator>::deallocate(m_alloc, chunk, first_chunk << k);
+    }
+}
+
+template<class T, class Allocator>
+typename slot_table<T, Allocator>::slot& slot_table<T, Allocator>::operator[](
+    std::size_t index
+) const noexcept {
+    std::size_t offset;
+    std::size_t k = chunkOf(index, offset);
+    return m_chunks[k].load(std::memory_order_acquire)[offset];
+}
+
+template<class T, class Allocator>
+void slot_table<T, Allocator>::push_back() {
+    std::size_t offset;
+    std::size_t k = chunkOf(m_size, offset);
+    if(k >= max_chunks) {
+        throw std::length_error("A VariableDomain holds at most 2^32 generation slots.");
+    }
+    slot* chunk = m_chunks[k].load(std::memory_order_relaxed);
+    if(chunk == nullptr) {
+        chunk = std::allocator_traits<slot_allocator>::allocate(m_alloc, first_chunk << k);
+        for(std::size_t i = 0; i < (first_chunk << k); ++i) {
+            std::allocator_traits<slot_allocator>::construct(m_alloc, chunk + i);
+        }
+        m_chunks[k].store(chunk, std::memory_order_release);
+    }
+    chunk[offset].value.store(nullptr);
+    chunk[offset].generation.store(1);
+    ++m_size;
+}
+
+template<class T, class Allocator>
+std::size_t slot_table<T, Allocator>::chunkOf(
+    std::size_t index,
+    std::size_t& offset
+) noexcept {
+    std::uint64_t shifted = static_cast<std::uint64_t>(index) + first_chunk;
+    std::size_t k = 63 - count_leading_zeros(shifted) - 6;
+    offset = static_cast<std::size_t>(shifted - (static_cast<std::uint64_t>(first_chunk) << k));
+    return k;
+}
+
+//Publishes versions of a T to readers that take no lock, and frees the
+//replaced ones through epoch-based reclamation. A reader announces the
+//epoch it started in, in a slot of its own, before loading the current
+//version; a version replaced during epoch e is freed once no slot announces
+//an epoch at or before e. Readers only pay for claiming and releasing their
+//slot. When every slot is taken, further readers share an overflow counter
+//instead, and nothing is freed while it is above zero. Versions are
+//published by one writer at a time.
+template<class T>
+class epoch_reclaimer {
+    public:
+    static const std::size_t reader_slots = 64;
+
+    epoch_reclaimer() noexcept;
+    epoch_reclaimer(const epoch_reclaimer&) = delete;
+    epoch_reclaimer& operator=(const epoch_reclaimer&) = delete;
+    //No reader may be left
+    ~epoch_reclaimer();
+
+    //Claims a slot, or the overflow counter (slot reader_slots) if all of
+    //them are taken, and returns the current version, which stays alive
+    //until leave(slot)
+    const T* enter(std::size_t& slot);
+    void leave(std::size_t slot) noexcept;
+
+    //Makes version (which may be null) the current one
+    void publish(T* version);
+
+    private:
+    //A cache line each, so that readers do not bounce each other's
+    struct reader_slot {
+        //Zero while free
+        std::atomic<std::uint64_t> epoch;
+        char padding[64 - sizeof(std::atomic<std::uint64_t>)];
+    };
+
+    reader_slot m_readers[reader_slots];
+    //Readers that found no free slot
+    std::atomic<std::size_t> m_overflow;
+    std::atomic<std::uint64_t> m_epoch;
+    std::atomic<T*> m_current;
+    //Replaced versions, with the epoch they were replaced in
+    std::vector<std::pair<T*, std::uint64_t>> m_retired;
+
+    void reclaim();
+};
+
+template<class T>
+epoch_reclaimer<T>::epoch_reclaimer() noexcept:
+    m_overflow(0), m_epoch(1), m_current(nullptr), m_retired()
+{
+    for(reader_slot& reader : m_readers) {
+        reader.epoch.store(0, std::memory_order_relaxed);
+    }
+}
+
+template<class T>
+epoch_reclaimer<T>::~epoch_reclaimer() {
+    delete m_current.load(std::memory_order_relaxed);
+    for(auto& retired : m_retired) {
+        delete retired.first;
+    }
+}
+
+//Everything is sequentially consistent: a reader that loaded a version
+//before it was replaced had announced itself before the writer looked at
+//the slots, with an epoch no later than the one the version was retired in
+template<class T>
+const T* epoch_reclaimer<T>::enter(std::size_t& slot) {
+    static std::atomic<std::size_t> next_hint(0);
+    thread_local std::size_t hint = next_hint++ % reader_slots;
+
+    for(std::size_t tries = 0; tries < reader_slots; ++tries) {
+        reader_slot& reader = m_readers[hint];
+        std::uint64_t free = 0;
+        if(reader.epoch.load(std::memory_order_relaxed) == 0
+            && reader.epoch.compare_exchange_strong(free, m_epoch.load()))
+        {
+            slot = hint;
+            return m_current.load();
+        }
+        hint = (hint + 1) % reader_slots;
+    }
+
+    m_overflow.fetch_add(1);
+    slot = reader_slots;
+    return m_current.load();
+}
+
+template<class T>
+void epoch_reclaimer<T>::leave(std::size_t slot) noexcept {
+    if(slot == reader_slots) {
+        m_overflow.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+    m_readers[slot].epoch.store(0, std::memory_order_release);
+}
+
+template<class T>
+void epoch_reclaimer<T>::publish(T* version) {
+    //Room is made first, so that a version is never lost between the
+    //exchange and the retirement
+    if(m_retired.size() == m_retired.capacity()) {
+        m_retired.reserve(2 * m_retired.size() + 1);
+    }
+    T* replaced = m_current.exchange(version);
+    if(replaced != nullptr) {
+        m_retired.push_back(std::make_pair(replaced, m_epoch.fetch_add(1)));
+    }
+    reclaim();
+}
+
+//Overflowing readers announce no epoch, so they hold back every version
+template<class T>
+void epoch_reclaimer<T>::reclaim() {
+    if(m_overflow.load() != 0) {
+        return;
+    }
+    std::uint64_t oldest = UINT64_MAX;
+    for(reader_slot& reader : m_readers) {
+        std::uint64_t epoch = reader.epoch.load();
+        if(epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    auto kept = m_retired.begin();
+    for(auto& retired : m_retired) {
+        if(retired.second < oldest) {
+            delete retired.first;
+        } else {
+            *kept++ = retired;
+        }
+    }
+    m_retired.erase(kept, m_retired.end());
+}
+
+//Hands out slots that never move until they are given back, so storages
+//that keep their lookup structure elsewhere can still offer stable addresses.
+//The owner has to destroy every live value before the pool goes away.
+//Chunks of slots come from Allocator, which also constructs the values, so
+//allocator-aware ones (std::pmr::string) allocate through it as well.
+template<class T, class Allocator = std::allocator<T>>
+class value_pool {
+    public:
+    explicit value_pool(const Allocator& alloc = Allocator());
+    value_pool(value_pool&& other);
+    value_pool& operator=(value_pool&& other) = delete;
+    ~value_pool();
+
+    template<class... Args>
+    T* create(Args&&... args);
+    void destroy(const T* ptr);
+
+    private:
+    union slot {
+        slot* next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    using slot_allocator = rebind_alloc<Allocator, slot>;
+    using slot_traits = std::allocator_traits<slot_allocator>;
+    using value_allocator = rebind_alloc<Allocator, T>;
+    using value_traits = std::allocator_traits<value_allocator>;
+
+    static const std::size_t chunk_size = 64;
+
+    slot_allocator m_alloc;
+    value_allocator m_value_alloc;
+    std::vector<slot*, rebind_alloc<Allocator, slot*>> m_chunks;
+    slot* m_free;
+};
+
+template<class T, class Allocator>
+value_pool<T, Allocator>::value_pool(
+    const Allocator& alloc
+): m_alloc(alloc), m_value_alloc(alloc), m_chunks(alloc), m_free(nullptr) {}
+
+template<class T, class Allocator>
+value_pool<T, Allocator>::value_pool(
+    value_pool&& other
+): m_alloc(std::move(other.m_alloc)), m_value_alloc(std::move(other.m_value_alloc)),
+    m_chunks(std::move(other.m_chunks)), m_free(other.m_free)
+{
+    other.m_free = nullptr;
+}
+
+template<class T, class Allocator>
+value_pool<T, Allocator>::~value_pool() {
+    for(slot* chunk : m_chunks) {
+        slot_traits::deallocate(m_alloc, chunk, chunk_size);
+    }
+}
+
+template<class T, class Allocator>
+template<class... Args>
+T* value_pool<T, Allocator>::create(Args&&... args) {
+    if(m_free == nullptr) {
+        slot* chunk = slot_traits::allocate(m_alloc, chunk_size);
+        try {
+            m_chunks.push_back(chunk);
+        } catch(...) {
+            slot_traits::deallocate(m_alloc, chunk, chunk_size);
+            throw;
+        }
+        for(std::size_t i = 0; i < chunk_size; ++i) {
+            chunk[i].next = i + 1 < chunk_size ? &chunk[i + 1] : nullptr;
+        }
+        m_free = &chunk[0];
+    }
+
+    slot* s = m_free;
+    m_free = s->next;
+    try {
+        T* ptr = reinterpret_cast<T*>(&s->storage);
+        value_traits::construct(m_value_alloc, ptr, std::forward<Args>(args)...);
+        return ptr;
+    } catch(...) {
+        s->next = m_free;
+        m_free = s;
+        throw;
+    }
+}
+
+template<class T, class Allocator>
+void value_pool<T, Allocator>::destroy(const T* ptr) {
+    value_traits::destroy(m_value_alloc, const_cast<T*>(ptr));
+    slot* s = reinterpret_cast<slot*>(const_cast<T*>(ptr));
+    s->next = m_free;
+    m_free = s;
+}
+
+//Free lists of fixed-size blocks, one per size class, carved out of chunks
+//taken from Upstream (an allocator of char). Freed blocks go back on their
+//list and are handed out again, so once a workload has reached its peak
+//the pool no longer calls into Upstream. Chunks are only given back when
+//the pool is destroyed.
+template<class Upstream>
+class node_pool {
+    public:
+    //Blocks are multiples of granularity bytes, up to max_block_size
+    static const std::size_t granularity = alignof(std::max_align_t);
+    static const std::size_t max_block_size = 256;
+
+    explicit node_pool(const Upstream& upstream);
+    node_pool(const node_pool& other) = delete;
+    node_pool& operator=(const node_pool& other) = delete;
+    ~node_pool();
+
+    const Upstream& upstream() const;
+
+    void* allocate(std::size_t size);
+    void deallocate(void* ptr, std::size_t size);
+
+    private:
+    struct free_block {
+        free_block* next;
+    };
+    //Start of every chunk, linking them together
+    union chunk_header {
+        chunk_header* next;
+        std::max_align_t alignment;
+    };
+
+    static const std::size_t chunk_size = 16 * 1024;
+    static const std::size_t size_classes = max_block_size / granularity;
+
+    Upstream m_upstream;
+    free_block* m_free[size_classes];
+    chunk_header* m_chunks;
+    char* m_cursor;
+    std::size_t m_remaining;
+};
+
+template<class Upstream>
+node_pool<Upstream>::node_pool(
+    const Upstream& upstream
+): m_upstream(upstream), m_free(), m_chunks(nullptr), m_cursor(nullptr), m_remaining(0) {}
+
+template<class Upstream>
+node_pool<Upstream>::~node_pool() {
+    while(m_chunks != nullptr) {
+        chunk_header* next = m_chunks->next;
+        std::allocator_traits<Upstream>::deallocate(
+            m_upstream, reinterpret_cast<char*>(m_chunks), chunk_size);
+        m_chunks = next;
+    }
+}
+
+template<class Upstream>
+const Upstream& node_pool<Upstream>::upstream() const {
+    return m_upstream;
+}
+
+template<class Upstream>
+void* node_pool<Upstream>::allocate(std::size_t size) {
+    std::size_t size_class = (size + granularity - 1) / granularity - 1;
+    if(m_free[size_class] != nullptr) {
+        free_block* block = m_free[size_class];
+        m_free[size_class] = block->next;
+        return block;
+    }
+
+    std::size_t block_size = (size_class + 1) * granularity;
+    if(block_size > m_remaining) {
+        char* chunk = std::allocator_traits<Upstream>::allocate(m_upstream, chunk_size);
+        chunk_header* header = reinterpret_cast<chunk_header*>(chunk);
+        header->next = m_chunks;
+        m_chunks = header;
+        m_cursor = chunk + sizeof(chunk_header);
+        m_remaining = chunk_size - sizeof(chunk_header);
+    }
+    void* block = m_cursor;
+    m_cursor += block_size;
+    m_remaining -= block_size;
+    return block;
+}
+
+template<class Upstream>
+void node_pool<Upstream>::deallocate(void* ptr, std::size_t size) {
+    std::size_t size_class = (size + granularity - 1) / granularity - 1;
+    free_block* block = static_cast<free_block*>(ptr);
+    block->next = m_free[size_class];
+    m_free[size_class] = block;
+}
+
+//splitmix64 finalizer
+inline std::uint64_t mix64(std::uint64_t x) {
+    x ^= x >> 30;
+    x *= UINT64_C(0xBF58476D1CE4E5B9);
+    x ^= x >> 27;
+    x *= UINT64_C(0x94D049BB133111EB);
+    x ^= x >> 31;
+    return x;
+}
+
+//Maps x onto [0, n) without a division
+inline std::uint32_t reduce(std::uint32_t x, std::uint32_t n) {
+    return static_cast<std::uint32_t>((static_cast<std::uint64_t>(x) * n) >> 32);
+}
+
+//Equality as seen by an ordering: neither value goes before the other
+template<class T, class Compare>
+class equivalent {
+    public:
+    explicit equivalent(const Compare& comp): m_comp(comp) {}
+
+    bool operator()(const T& lhs, const T& rhs) const {
+        return !m_comp(lhs, rhs) && !m_comp(rhs, lhs);
+    }
+
+    private:
+    Compare m_comp;
+};
+
+//Minimal perfect hash over a fixed set of values, built by hash and
+//displace: the values are spread over buckets of about four, and each bucket
+//gets the first seed that sends all of its values to free slots of a table
+//holding exactly one slot per value. A lookup is then one hash, one table
+//load and one comparison.
+template<class T, class Hash, class KeyEqual>
+class perfect_hash_index {
+    public:
+    template<class InputIt>
+    perfect_hash_index(
+        InputIt first, InputIt last,
+        const Hash& hash, const KeyEqual& equal
+    );
+
+    //False if no seeds could be found, e.g. because two values share a hash
+    bool valid() const;
+
+    template<class K>
+    const T* find(const K& key) const;
+
+    private:
+    struct entry {
+        const T* value;
+        //Low half of the value's hash, to turn most misses away unread
+        std::uint32_t fingerprint;
+    };
+
+    static const unsigned salt_attempts = 8;
+
+    Hash m_hash;
+    KeyEqual m_equal;
+    std::uint64_t m_salt;
+    bool m_valid;
+    std::vector<std::uint32_t> m_seeds;
+    std::vector<entry> m_table;
+
+    template<class K>
+    std::uint64_t hashOf(const K& key) const;
+    std::uint32_t bucketOf(std::uint64_t hash) const;
+    std::uint32_t slotOf(std::uint64_t hash, std::uint32_t seed) const;
+    bool place(const std::vector<const T*>& values);
+
+    template<class K>
+    const T* find(const K& key, std::true_type) const;
+    template<class K>
+    const T* find(const K& key, std::false_type) const;
+};
+
+template<class T, class Hash, class KeyEqual>
+template<class InputIt>
+perfect_hash_index<T, Hash, KeyEqual>::perfect_hash_index(
+    InputIt first, InputIt last,
+    const Hash& hash, const KeyEqual& equal
+): m_hash(hash), m_equal(equal), m_salt(0), m_valid(false), m_seeds(), m_table()
+{
+    std::vector<const T*> values;
+    for(; first != last; ++first) {
+        values.push_back(&*first);
+    }
+    if(values.size() > UINT32_MAX) {
+        return;
+    }
+
+    for(unsigned attempt = 0; attempt < salt_attempts && !m_valid; ++attempt) {
+        m_salt = mix64(attempt);
+        m_valid = place(values);
+    }
+    if(!m_valid) {
+        m_seeds.clear();
+        m_table.clear();
+    }
+}
+
+template<class T, class Hash, class KeyEqual>
+bool perfect_hash_index<T, Hash, KeyEqual>::valid() const {
+    return m_valid;
+}
+
+template<class T, class Hash, class KeyEqual>
+template<class K>
+const T* perfect_hash_index<T, Hash, KeyEqual>::find(const K& key) const {
+    return find(key, std::integral_constant<bool,
+        (is_transparent<Hash>::value && is_transparent<KeyEqual>::value)
+        || std::is_same<K, T>::value>());
+}
+
+template<class T, class Hash, class KeyEqual>
+template<class K>
+const T* perfect_hash_index<T, Hash, KeyEqual>::find(
+    const K& key,
+    std::true_type
+) const {
+    if(m_table.empty()) {
+        return nullptr;
+    }
+
+    std::uint64_t hash = hashOf(key);
+    const entry& slot = m_table[slotOf(hash, m_seeds[bucketOf(hash)])];
+    if(slot.fingerprint != static_cast<std::uint32_t>(hash)
+        || !m_equal(*slot.value, key))
+    {
+        return nullptr;
+    }
+    return slot.value;
+}
+
+template<class T, class Hash, class KeyEqual>
+template<class K>
+const T* perfect_hash_index<T, Hash, KeyEqual>::find(
+    const K& key,
+    std::false_type
+) const {
+    const T converted(key);
+    return find(converted, std::true_type());
+}
+
+template<class T, class Hash, class KeyEqual>
+template<class K>
+std::uint64_t perfect_hash_index<T, Hash, KeyEqual>::hashOf(const K& key) const {
+    return mix64(static_cast<std::uint64_t>(m_hash(key)) ^ m_salt);
+}
+
+template<class T, class Hash, class KeyEqual>
+std::uint32_t perfect_hash_index<T, Hash, KeyEqual>::bucketOf(std::uint64_t hash) const {
+    return reduce(static_cast<std::uint32_t>(hash >> 32),
+        static_cast<std::uint32_t>(m_seeds.size()));
+}
+
+template<class T, class Hash, class KeyEqual>
+std::uint32_t perfect_hash_index<T, Hash, KeyEqual>::slotOf(
+    std::uint64_t hash,
+    std::uint32_t seed
+) const {
+    return reduce(
+        static_cast<std::uint32_t>(mix64(hash + seed * UINT64_C(0x9E3779B97F4A7C15))),
+        static_cast<std::uint32_t>(m_table.size()));
+}
+
+template<class T, class Hash, class KeyEqual>
+bool perfect_hash_index<T, Hash, KeyEqual>::place(
+    const std::vector<const T*>& values
+) {
+    std::size_t count = values.size();
+    m_seeds.assign(count / 4 + 1, 0);
+    m_table.assign(count, entry());
+
+    std::vector<std::uint64_t> hashes(count);
+    std::vector<std::vector<std::uint32_t>> buckets(m_seeds.size());
+    for(std::size_t i = 0; i < count; ++i) {
+        hashes[i] = hashOf(*values[i]);
+        buckets[bucketOf(hashes[i])].push_back(static_cast<std::uint32_t>(i));
+    }
+
+    //The largest buckets go first, while most of the table is still free
+    std::vector<std::uint32_t> order(buckets.size());
+    for(std::size_t b = 0; b < order.size(); ++b) {
+        order[b] = static_cast<std::uint32_t>(b);
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [&buckets](std::uint32_t lhs, std::uint32_t rhs) {
+            return buckets[lhs].size() > buckets[rhs].size();
+        });
+
+    std::vector<bool> taken(count, false);
+    std::vector<std::uint32_t> slots;
+    std::uint64_t max_seed = static_cast<std::uint64_t>(count) * 16 + 1024;
+    for(auto b : order) {
+        const std::vector<std::uint32_t>& members = buckets[b];
+        if(members.empty()) {
+            break;
+        }
+
+        bool placed = false;
+        for(std::uint64_t seed = 0; seed < max_seed && !placed; ++seed) {
+            slots.clear();
+            placed = true;
+            for(auto i : members) {
+                std::uint32_t slot = slotOf(hashes[i], static_cast<std::uint32_t>(seed));
+                if(taken[slot] || std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+                    placed = false;
+                    break;
+                }
+                slots.push_back(slot);
+            }
+            if(placed) {
+                m_seeds[b] = static_cast<std::uint32_t>(seed);
+            }
+        }
+        if(!placed) {
+            return false;
+        }
+
+        for(std::size_t k = 0; k < members.size(); ++k) {
+            taken[slots[k]] = true;
+            m_table[slots[k]].value = values[members[k]];
+            m_table[slots[k]].fingerprint = static_cast<std::uint32_t>(hashes[members[k]]);
+        }
+    }
+    return true;
+}
+
+//Copy of a set of values laid out in the breadth-first order of a complete
+//binary search tree (Eytzinger layout), alongside the address of each value.
+//A lookup walks down from the root with one comparison and no branch per
+//level, and the top of the tree shares a few cache lines. While descending,
+//it prefetches the line holding the node's descendants four levels down.
+//Slot 0 of both arrays is unused, so that node k has children 2k and 2k + 1.
+template<class T, class Compare>
+class eytzinger_index {
+    public:
+    explicit eytzinger_index(const Compare& comp);
+
+    //Rebuilds the index over values that stay where they are until the
+    //next call
+    template<class InputIt>
+    void assign(InputIt first, InputIt last);
+    void clear();
+
+    template<class K>
+    const T* find(const K& key) const;
+
+    private:
+    static const std::size_t block = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+
+    Compare m_comp;
+    std::vector<T> m_keys;
+    std::vector<const T*> m_values;
+
+    void place(const std::vector<const T*>& sorted, std::size_t& next, std::size_t node);
+
+    template<class K>
+    const T* find(const K& key, std::true_type) const;
+    template<class K>
+    const T* find(const K& key, std::false_type) const;
+};
+
+template<class T, class Compare>
+eytzinger_index<T, Compare>::eytzinger_index(
+    const Compare& comp
+): m_comp(comp), m_keys(), m_values() {}
+
+template<class T, class Compare>
+template<class InputIt>
+void eytzinger_index<T, Compare>::assign(
+    InputIt first, InputIt last
+) {
+    std::vector<const T*> sorted;
+    for(; first != last; ++first) {
+        sorted.push_back(&*first);
+    }
+    std::sort(sorted.begin(), sorted.end(), [this](const T* lhs, const T* rhs) {
+        return m_comp(*lhs, *rhs);
+    });
+
+    clear();
+    if(sorted.empty()) {
+        return;
+    }
+    m_keys.assign(sorted.size() + 1, *sorted.front());
+    m_values.assign(sorted.size() + 1, nullptr);
+    std::size_t next = 0;
+    place(sorted, next, 1);
+}
+
+template<class T, class Compare>
+void eytzinger_index<T, Compare>::clear() {
+    std::vector<T>().swap(m_keys);
+    std::vector<const T*>().swap(m_values);
+}
+
+template<class T, class Compare>
+template<class K>
+const T* eytzinger_index<T, Compare>::find(
+    const K& key
+) const {
+    return find(key, std::integral_constant<bool,
+        is_transparent<Compare>::value || std::is_same<K, T>::value>());
+}
+
+template<class T, class Compare>
+template<class K>
+const T* eytzinger_index<T, Compare>::find(
+    const K& key,
+    std::true_type
+) const {
+    if(m_values.empty()) {
+        return nullptr;
+    }
+
+    const std::size_t size = m_values.size() - 1;
+    std::size_t node = 1;
+    while(node <= size) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(m_keys.data() + node * block);
+#endif
+        node = 2 * node + static_cast<std::size_t>(m_comp(m_keys[node], key));
+    }
+    //Undo the right turns taken after the last left one, landing on the
+    //first value not less than the key
+    node >>= count_trailing_zeros(~static_cast<std::uint64_t>(node)) + 1;
+
+    if(node == 0 || m_comp(key, m_keys[node])) {
+        return nullptr;
+    }
+    return m_values[node];
+}
+
+template<class T, class Compare>
+template<class K>
+const T* eytzinger_index<T, Compare>::find(
+    const K& key,
+    std::false_type
+) const {
+    const T converted(key);
+    return find(converted, std::true_type());
+}
+
+template<class T, class Compare>
+void eytzinger_index<T, Compare>::place(
+    const std::vector<const T*>& sorted,
+    std::size_t& next,
+    std::size_t node
+) {
+    if(node > sorted.size()) {
+        return;
+    }
+    place(sorted, next, 2 * node);
+    m_keys[node] = *sorted[next];
+    m_values[node] = sorted[next];
+    ++next;
+    place(sorted, next, 2 * node + 1);
+}
+
+//Bloom filter made of 512-bit blocks: a value hashes to one block and sets
+//or tests all of its bits there, so a test reads a single cache line. The
+//blocks start on a 64 byte boundary of the word array.
+//Sized for a number of values and a target false positive rate, which it
+//exceeds once more values than that have been inserted.
+template<class T, class Hash>
+class blocked_bloom_filter {
+    public:
+    explicit blocked_bloom_filter(const Hash& hash);
+
+    //Empties the filter and sizes it for capacity values
+    void reset(std::size_t capacity, double false_positive_rate);
+    void clear();
+
+    std::size_t size() const;
+    std::size_t capacity() const;
+
+    void insert(const T& value);
+
+    //False only for values that were never inserted
+    bool mayContain(const T& key) const;
+    template<class K>
+    bool mayContain(const K& key) const;
+
+    private:
+    static const std::size_t block_words = 8;
+
+    Hash m_hash;
+    std::vector<std::uint64_t> m_words;
+    //Index of the first word of the first block within m_words
+    std::size_t m_first;
+    std::uint32_t m_blocks;
+    unsigned m_probes;
+    std::size_t m_size;
+    std::size_t m_capacity;
+
+    template<class K>
+    std::uint64_t hashOf(const K& key) const;
+    template<class K>
+    bool test(const K& key) const;
+
+    template<class K>
+    bool mayContain(const K& key, std::true_type) const;
+    template<class K>
+    bool mayContain(const K& key, std::false_type) const;
+};
+
+template<class T, class Hash>
+blocked_bloom_filter<T, Hash>::blocked_bloom_filter(
+    const Hash& hash
+): m_hash(hash), m_words(), m_first(0), m_blocks(0), m_probes(0), m_size(0), m_capacity(0) {}
+
+template<class T, class Hash>
+void blocked_bloom_filter<T, Hash>::reset(
+    std::size_t capacity,
+    double false_positive_rate
+) {
+    const double ln2 = std::log(2.0);
+    double bits_per_value = -std::log(false_positive_rate) / (ln2 * ln2);
+    double blocks = std::ceil(static_cast<double>(capacity) * bits_per_value / (64 * block_words));
+
+    m_blocks = static_cast<std::uint32_t>(std::min(std::max(blocks, 1.0), 4294967295.0));
+    m_probes = static_cast<unsigned>(std::min(std::max(std::lround(bits_per_value * ln2), 1L), 16L));
+    m_size = 0;
+    m_capacity = capacity;
+
+    m_words.assign(static_cast<std::size_t>(m_blocks) * block_words + block_words - 1, 0);
+    std::size_t misalignment = reinterpret_cast<std::uintptr_t>(m_words.data()) % 64;
+    m_first = misalignment == 0 ? 0 : (64 - misalignment) / sizeof(std::uint64_t);
+}
+
+template<class T, class Hash>
+void blocked_bloom_filter<T, Hash>::clear() {
+    std::vector<std::uint64_t>().swap(m_words);
+    m_first = 0;
+    m_blocks = 0;
+    m_size = 0;
+    m_capacity = 0;
+}
+
+template<class T, class Hash>
+std::size_t blocked_bloom_filter<T, Hash>::size() const {
+    return m_size;
+}
+
+template<class T, class Hash>
+std::size_t blocked_bloom_filter<T, Hash>::capacity() const {
+    return m_capacity;
+}
+
+template<class T, class Hash>
+void blocked_bloom_filter<T, Hash>::insert(
+    const T& value
+) {
+    std::uint64_t hash = hashOf(value);
+    std::uint64_t* block = m_words.data() + m_first
+        + static_cast<std::size_t>(reduce(static_cast<std::uint32_t>(hash >> 32), m_blocks)) * block_words;
+    //Double hashing within the block, from the two halves of a second hash
+    std::uint64_t probes = mix64(hash);
+    std::uint32_t bit = static_cast<std::uint32_t>(probes);
+    std::uint32_t step = static_cast<std::uint32_t>(probes >> 32) | 1;
+    for(unsigned i = 0; i < m_probes; ++i, bit += step) {
+        block[bit >> 29] |= UINT64_C(1) << (bit >> 23 & 63);
+    }
+    ++m_size;
+}
+
+template<class T, class Hash>
+bool blocked_bloom_filter<T, Hash>::mayContain(
+    const T& key
+) const {
+    return test(key);
+}
+
+template<class T, class Hash>
+template<class K>
+bool blocked_bloom_filter<T, Hash>::mayContain(
+    const K& key
+) const {
+    return mayContain(key, is_transparent<Hash>());
+}
+
+template<class T, class Hash>
+template<class K>
+bool blocked_bloom_filter<T, Hash>::mayContain(
+    const K& key,
+    std::true_type
+) const {
+    return test(key);
+}
+
+template<class T, class Hash>
+template<class K>
+bool blocked_bloom_filter<T, Hash>::mayContain(
+    const K& key,
+    std::false_type
+) const {
+    const T converted(key);
+    return test(converted);
+}
+
+template<class T, class Hash>
+template<class K>
+std::uint64_t blocked_bloom_filter<T, Hash>::hashOf(const K& key) const {
+    return mix64(static_cast<std::uint64_t>(m_hash(key)));
+}
+
+template<class T, class Hash>
+template<class K>
+bool blocked_bloom_filter<T, Hash>::test(
+    const K& key
+) const {
+    if(m_blocks == 0) {
+        return true;
+    }
+
+    std::uint64_t hash = hashOf(key);
+    const std::uint64_t* block = m_words.data() + m_first
+        + static_cast<std::size_t>(reduce(static_cast<std::uint32_t>(hash >> 32), m_blocks)) * block_words;
+    std::uint64_t probes = mix64(hash);
+    std::uint32_t bit = static_cast<std::uint32_t>(probes);
+    std::uint32_t step = static_cast<std::uint32_t>(probes >> 32) | 1;
+    std::uint64_t missing = 0;
+    for(unsigned i = 0; i < m_probes; ++i, bit += step) {
+        missing |= ~block[bit >> 29] & UINT64_C(1) << (bit >> 23 & 63);
+    }
+    return missing == 0;
+}
+
+//Batch membership of integers against a sorted array
+//
+//Up to this many values, every input is compared against all of them at
+//once; past it, each input runs a branchless binary search instead, whose
+//step compiles to a conditional move.
+const std::size_t batch_broadcast_limit = 16;
+
+template<class T>
+bool broadcast_contains(const T* sorted, std::size_t size, T value) {
+    bool found = false;
+    for(std::size_t k = 0; k < size; ++k) {
+        found |= sorted[k] == value;
+    }
+    return found;
+}
+
+//Handles whole 64 value blocks with vector instructions when the target
+//has them, returning how many values it went through
+template<class T>
+std::size_t vector_contains(
+    const T*, std::size_t,
+    const T*, std::size_t,
+    std::uint64_t*,
+    std::false_type
+) {
+    return 0;
+}
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#if defined(__AVX2__)
+using simd_vector = __m256i;
+
+template<std::size_t Size>
+struct simd_lanes;
+
+template<>
+struct simd_lanes<4> {
+    static const std::size_t count = 8;
+    static const bool can_search = true;
+
+    static simd_vector load(const void* ptr) {
+        return _mm256_loadu_si256(static_cast<const simd_vector*>(ptr));
+    }
+    static simd_vector broadcast(std::uint64_t value) {
+        return _mm256_set1_epi32(static_cast<int>(value));
+    }
+    static simd_vector equal(simd_vector lhs, simd_vector rhs) {
+        return _mm256_cmpeq_epi32(lhs, rhs);
+    }
+    static simd_vector greater(simd_vector lhs, simd_vector rhs) {
+        return _mm256_cmpgt_epi32(lhs, rhs);
+    }
+    static simd_vector add(simd_vector lhs, simd_vector rhs) {
+        return _mm256_add_epi32(lhs, rhs);
+    }
+    static simd_vector gather(const void* base, simd_vector indices) {
+        return _mm256_i32gather_epi32(static_cast<const int*>(base), indices, 4);
+    }
+    static std::uint64_t mask(simd_vector v) {
+        return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(v)));
+    }
+};
+
+template<>
+struct simd_lanes<8> {
+    static const std::size_t count = 4;
+    static const bool can_search = true;
+
+    static simd_vector load(const void* ptr) {
+        return _mm256_loadu_si256(static_cast<const simd_vector*>(ptr));
+    }
+    static simd_vector broadcast(std::uint64_t value) {
+        return _mm256_set1_epi64x(static_cast<long long>(value));
+    }
+    static simd_vector equal(simd_vector lhs, simd_vector rhs) {
+        return _mm256_cmpeq_epi64(lhs, rhs);
+    }
+    static simd_vector greater(simd_vector lhs, simd_vector rhs) {
+        return _mm256_cmpgt_epi64(lhs, rhs);
+    }
+    static simd_vector add(simd_vector lhs, simd_vector rhs) {
+        return _mm256_add_epi64(lhs, rhs);
+    }
+    static simd_vector gather(const void* base, simd_vector indices) {
+        return _mm256_i64gather_epi64(static_cast<const long long*>(base), indices, 8);
+    }
+    static std::uint64_t mask(simd_vector v) {
+        return static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(v)));
+    }
+};
+
+inline simd_vector simd_zero() { return _mm256_setzero_si256(); }
+inline simd_vector simd_or(simd_vector lhs, simd_vector rhs) { return _mm256_or_si256(lhs, rhs); }
+inline simd_vector simd_xor(simd_vector lhs, simd_vector rhs) { return _mm256_xor_si256(lhs, rhs); }
+inline simd_vector simd_andnot(simd_vector lhs, simd_vector rhs) { return _mm256_andnot_si256(lhs, rhs); }
+#else
+using simd_vector = __m128i;
+
+template<std::size_t Size>
+struct simd_lanes;
+
+//Without gathers, the search stays scalar
+template<>
+struct simd_lanes<4> {
+    static const std::size_t count = 4;
+    static const bool can_search = false;
+
+    static simd_vector load(const void* ptr) {
+        return _mm_loadu_si128(static_cast<const simd_vector*>(ptr));
+    }
+    static simd_vector broadcast(std::uint64_t value) {
+        return _mm_set1_epi32(static_cast<int>(value));
+    }
+    static simd_vector equal(simd_vector lhs, simd_vector rhs) {
+        return _mm_cmpeq_epi32(lhs, rhs);
+    }
+    static simd_vector greater(simd_vector lhs, simd_vector rhs) {
+        return _mm_cmpgt_epi32(lhs, rhs);
+    }
+    static simd_vector add(simd_vector lhs, simd_vector rhs) {
+        return _mm_add_epi32(lhs, rhs);
+    }
+    static simd_vector gather(const void*, simd_vector indices) {
+        return indices;
+    }
+    static std::uint64_t mask(simd_vector v) {
+        return static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(v)));
+    }
+};
+
+template<>
+struct simd_lanes<8> {
+    static const std::size_t count = 2;
+    static const bool can_search = false;
+
+    static simd_vector load(const void* ptr) {
+        return _mm_loadu_si128(static_cast<const simd_vector*>(ptr));
+    }
+    static simd_vector broadcast(std::uint64_t value) {
+        return _mm_set1_epi64x(static_cast<long long>(value));
+    }
+    static simd_vector equal(simd_vector lhs, simd_vector rhs) {
+        return _mm_cmpeq_epi64(lhs, rhs);
+    }
+    //_mm_cmpgt_epi64 is SSE4.2, and the search that would call this is off
+    static simd_vector greater(simd_vector lhs, simd_vector) {
+        return lhs;
+    }
+    static simd_vector add(simd_vector lhs, simd_vector rhs) {
+        return _mm_add_epi64(lhs, rhs);
+    }
+    static simd_vector gather(const void*, simd_vector indices) {
+        return indices;
+    }
+    static std::uint64_t mask(simd_vector v) {
+        return static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(v)));
+    }
+};
+
+inline simd_vector simd_zero() { return _mm_setzero_si128(); }
+inline simd_vector simd_or(simd_vector lhs, simd_vector rhs) { return _mm_or_si128(lhs, rhs); }
+inline simd_vector simd_xor(simd_vector lhs, simd_vector rhs) { return _mm_xor_si128(lhs, rhs); }
+inline simd_vector simd_andnot(simd_vector lhs, simd_vector rhs) { return _mm_andnot_si128(lhs, rhs); }
+#endif
+
+template<class T>
+std::size_t vector_contains(
+    const T* sorted, std::size_t size,
+    const T* values, std::size_t count,
+    std::uint64_t* bitmask_out,
+    std::true_type
+) {
+    using lanes = simd_lanes<sizeof(T)>;
+    std::size_t blocks = count / 64;
+
+    if(size <= batch_broadcast_limit) {
+        simd_vector keys[batch_broadcast_limit];
+        for(std::size_t k = 0; k < size; ++k) {
+            keys[k] = lanes::broadcast(static_cast<std::uint64_t>(sorted[k]));
+        }
+
+        for(std::size_t block = 0; block < blocks; ++block) {
+            std::uint64_t word = 0;
+            for(std::size_t lane = 0; lane < 64; lane += lanes::count) {
+                simd_vector input = lanes::load(values + block * 64 + lane);
+                simd_vector found = simd_zero();
+                for(std::size_t k = 0; k < size; ++k) {
+                    found = simd_or(found, lanes::equal(input, keys[k]));
+                }
+                word |= lanes::mask(found) << lane;
+            }
+            bitmask_out[block] = word;
+        }
+        return blocks * 64;
+    }
+
+    if(!lanes::can_search || size > static_cast<std::size_t>(INT32_MAX)) {
+        return 0;
+    }
+
+    //Signed comparisons order unsigned values once their top bit is flipped
+    simd_vector flip = lanes::broadcast(std::is_signed<T>::value
+        ? 0 : static_cast<std::uint64_t>(1) << (sizeof(T) * 8 - 1));
+    //The searches of a whole block advance in lockstep, so that their gathers
+    //overlap instead of each waiting on the previous one
+    const std::size_t vectors = 64 / lanes::count;
+    simd_vector keys[vectors];
+    simd_vector bases[vectors];
+    for(std::size_t block = 0; block < blocks; ++block) {
+        for(std::size_t v = 0; v < vectors; ++v) {
+            keys[v] = simd_xor(lanes::load(values + block * 64 + v * lanes::count), flip);
+            bases[v] = simd_zero();
+        }
+        for(std::size_t n = size; n > 1; n -= n / 2) {
+            simd_vector half = lanes::broadcast(n / 2);
+            for(std::size_t v = 0; v < vectors; ++v) {
+                simd_vector probe = simd_xor(lanes::gather(sorted, lanes::add(bases[v], half)), flip);
+                bases[v] = lanes::add(bases[v], simd_andnot(lanes::greater(probe, keys[v]), half));
+            }
+        }
+
+        std::uint64_t word = 0;
+        for(std::size_t v = 0; v < vectors; ++v) {
+            simd_vector found = simd_xor(lanes::gather(sorted, bases[v]), flip);
+            word |= lanes::mask(lanes::equal(found, keys[v])) << (v * lanes::count);
+        }
+        bitmask_out[block] = word;
+    }
+    return blocks * 64;
+}
+#endif
+
+//Sets bit i % 64 of bitmask_out[i / 64] for each values[i] found in sorted
+template<class T>
+void batch_contains(
+    const T* sorted, std::size_t size,
+    const T* values, std::size_t count,
+    std::uint64_t* bitmask_out
+) {
+    std::fill(bitmask_out, bitmask_out + (count + 63) / 64, 0);
+    if(size == 0) {
+        return;
+    }
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+    using vectorizable = std::integral_constant<bool, sizeof(T) == 4 || sizeof(T) == 8>;
+#else
+    using vectorizable = std::false_type;
+#endif
+    std::size_t done = vector_contains(sorted, size, values, count, bitmask_out, vectorizable());
+
+    if(size <= batch_broadcast_limit) {
+        for(std::size_t i = done; i < count; ++i) {
+            bool found = broadcast_contains(sorted, size, values[i]);
+            bitmask_out[i / 64] |= static_cast<std::uint64_t>(found) << (i % 64);
+        }
+        return;
+    }
+
+    //As in the vector search, a block of searches advances in lockstep
+    const T* bases[64];
+    for(std::size_t first = done; first < count; first += 64) {
+        std::size_t width = std::min<std::size_t>(64, count - first);
+        const T* block = values + first;
+        std::fill(bases, bases + width, sorted);
+        for(std::size_t n = size; n > 1; n -= n / 2) {
+            for(std::size_t i = 0; i < width; ++i) {
+                bases[i] = block[i] < bases[i][n / 2] ? bases[i] : bases[i] + n / 2;
+            }
+        }
+        for(std::size_t i = 0; i < width; ++i) {
+            bool found = *bases[i] == block[i];
+            bitmask_out[(first + i) / 64] |= static_cast<std::uint64_t>(found) << ((first + i) % 64);
+        }
+    }
+}
+
+}
+
+//Allocators
+
+//Allocates single objects, such as the nodes of std::set, from a node pool
+//shared by all the copies and rebinds of an allocator, and everything else
+//(arrays, over-aligned or large objects) from Upstream. A default
+//constructed NodePoolAllocator creates a pool of its own, so every
+//VariableDomain gets a separate pool unless it is handed one to share.
+//Not thread-safe: the pool is meant to serve one domain at a time.
+template<class T, class Upstream = std::allocator<T>>
+class NodePoolAllocator {
+    template<class U, class V>
+    friend class NodePoolAllocator;
+
+    using pool_type = drv_detail::node_pool<drv_detail::rebind_alloc<Upstream, char>>;
+    using upstream_type = drv_detail::rebind_alloc<Upstream, T>;
+
+    public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template<class U>
+    struct rebind {
+        using other = NodePoolAllocator<U, drv_detail::rebind_alloc<Upstream, U>>;
+    };
+
+    NodePoolAllocator();
+    explicit NodePoolAllocator(const Upstream& upstream);
+    template<class U, class V>
+    NodePoolAllocator(const NodePoolAllocator<U, V>& other) noexcept;
+
+    T* allocate(std::size_t n);
+    void deallocate(T* ptr, std::size_t n);
+
+    template<class U, class V>
+    bool operator==(const NodePoolAllocator<U, V>& other) const noexcept;
+    template<class U, class V>
+    bool operator!=(const NodePoolAllocator<U, V>& other) const noexcept;
+
+    private:
+    std::shared_ptr<pool_type> m_pool;
+
+    static bool pooled(std::size_t n);
+};
+
+template<class T, class Upstream>
+NodePoolAllocator<T, Upstream>::NodePoolAllocator():
+    NodePoolAllocator(Upstream()) {}
+
+template<class T, class Upstream>
+NodePoolAllocator<T, Upstream>::NodePoolAllocator(
+    const Upstream& upstream
+): m_pool(std::make_shared<pool_type>(drv_detail::rebind_alloc<Upstream, char>(upstream))) {}
+
+template<class T, class Upstream>
+template<class U, class V>
+NodePoolAllocator<T, Upstream>::NodePoolAllocator(
+    const NodePoolAllocator<U, V>& other
+) noexcept: m_pool(other.m_pool) {}
+
+template<class T, class Upstream>
+T* NodePoolAllocator<T, Upstream>::allocate(std::size_t n) {
+    if(pooled(n)) {
+        return static_cast<T*>(m_pool->allocate(sizeof(T)));
+    }
+    upstream_type upstream(m_pool->upstream());
+    return std::allocator_traits<upstream_type>::allocate(upstream, n);
+}
+
+template<class T, class Upstream>
+void NodePoolAllocator<T, Upstream>::deallocate(T* ptr, std::size_t n) {
+    if(pooled(n)) {
+        m_pool->deallocate(ptr, sizeof(T));
+        return;
+    }
+    upstream_type upstream(m_pool->upstream());
+    std::allocator_traits<upstream_type>::deallocate(upstream, ptr, n);
+}
+
+template<class T, class Upstream>
+template<class U, class V>
+bool NodePoolAllocator<T, Upstream>::operator==(
+    const NodePoolAllocator<U, V>& other
+) const noexcept {
+    return m_pool == other.m_pool;
+}
+
+template<class T, class Upstream>
+template<class U, class V>
+bool NodePoolAllocator<T, Upstream>::operator!=(
+    const NodePoolAllocator<U, V>& other
+) const noexcept {
+    return m_pool != other.m_pool;
+}
+
+template<class T, class Upstream>
+bool NodePoolAllocator<T, Upstream>::pooled(std::size_t n) {
+    return n == 1 && sizeof(T) <= pool_type::max_block_size
+        && alignof(T) <= pool_type::granularity;
+}
+
+//What a CountingAllocator has seen so far
+struct AllocationCounts {
+    std::size_t allocations;
+    std::size_t deallocations;
+    //Bytes allocated and not deallocated yet
+    std::size_t live_bytes;
+};
+
+namespace drv_detail {
+
+//Shared by the default constructed CountingAllocator(s) of every type
+inline AllocationCounts& global_allocation_counts() {
+    static AllocationCounts counts = AllocationCounts();
+    return counts;
+}
+
+}
+
+//std::allocator that records every call in an AllocationCounts, so tests
+//can check how much a piece of code allocates, e.g. that creating and
+//destroying variables against a pooled domain reaches the heap no more.
+//Default constructed allocators share one global record.
+//The counts are not synchronized.
+template<class T>
+class CountingAllocator {
+    template<class U>
+    friend class CountingAllocator;
+
+    public:
+    using value_type = T;
+
+    CountingAllocator() noexcept;
+    explicit CountingAllocator(AllocationCounts& counts) noexcept;
+    template<class U>
+    CountingAllocator(const CountingAllocator<U>& other) noexcept;
+
+    T* allocate(std::size_t n);
+    void deallocate(T* ptr, std::size_t n);
+
+    const AllocationCounts& counts() const noexcept;
+    static AllocationCounts& globalCounts() noexcept;
+
+    template<class U>
+    bool operator==(const CountingAllocator<U>& other) const noexcept;
+    template<class U>
+    bool operator!=(const CountingAllocator<U>& other) const noexcept;
+
+    private:
+    AllocationCounts* m_counts;
+};
+
+template<class T>
+CountingAllocator<T>::CountingAllocator() noexcept:
+    m_counts(&globalCounts()) {}
+
+template<class T>
+CountingAllocator<T>::CountingAllocator(
+    AllocationCounts& counts
+) noexcept: m_counts(&counts) {}
+
+template<class T>
+template<class U>
+CountingAllocator<T>::CountingAllocator(
+    const CountingAllocator<U>& other
+) noexcept: m_counts(other.m_counts) {}
+
+template<class T>
+T* CountingAllocator<T>::allocate(std::size_t n) {
+    T* ptr = std::allocator<T>().allocate(n);
+    ++m_counts->allocations;
+    m_counts->live_bytes += n * sizeof(T);
+    return ptr;
+}
+
+template<class T>
+void CountingAllocator<T>::deallocate(T* ptr, std::size_t n) {
+    std::allocator<T>().deallocate(ptr, n);
+    ++m_counts->deallocations;
+    m_counts->live_bytes -= n * sizeof(T);
+}
+
+template<class T>
+const AllocationCounts& CountingAllocator<T>::counts() const noexcept {
+    return *m_counts;
+}
+
+template<class T>
+AllocationCounts& CountingAllocator<T>::globalCounts() noexcept {
+    return drv_detail::global_allocation_counts();
+}
+
+template<class T>
+template<class U>
+bool CountingAllocator<T>::operator==(
+    const CountingAllocator<U>& other
+) const noexcept {
+    return m_counts == other.m_counts;
+}
+
+template<class T>
+template<class U>
+bool CountingAllocator<T>::operator!=(
+    const CountingAllocator<U>& other
+) const noexcept {
+    return m_counts != other.m_counts;
+}
+
+//Storage policies
+//
+//A storage policy decides how a VariableDomain keeps its allowed values.
+//Every policy exposes a nested `storage<value_type, Compare, Allocator>`
+//template that allocates through (rebinds of) Allocator, and every storage
+//keeps the address of a value stable until that value is erased, as
+//DomainRestrictedVariable(s) point straight at it.
+//A storage that cannot hold some value returns a null pointer from emplace.
+//Storages also name the hasher and key_equal a frozen VariableDomain builds
+//its perfect hash with; the ordered ones take theirs from CompareHash, so
+//that it agrees with Compare.
+
+//Red-black tree (std::set) backend, cheap to modify at any size
+struct SetStorage {
+    template<class value_type, class Compare, class Allocator>
+    class storage;
+};
+
+//Sorted contiguous array of the values, searched with a binary search.
+//Lookups stay within a few cache lines, while insertion and removal shift
+//the array. Meant for domains that are mostly read.
+//Requires a copyable value_type.
+struct FlatStorage {
+    template<class value_type, class Compare, class Allocator>
+    class storage;
+};
+
+//Open-addressing hash table with linear probing, for large domains that are
+//only ever checked for membership. Iteration order is unspecified.
+//Hash and KeyEqual default to std::hash and std::equal_to of the value_type.
+//When both are transparent, VariableDomain::isAllowedValue(K&&) hashes the
+//key as given instead of converting it to a value_type first.
+template<class Hash = void, class KeyEqual = void>
+struct HashStorage {
+    template<class value_type, class Compare, class Allocator>
+    class storage;
+};
+
+//One bit per value of the integral window [Min, Max]: a lookup is one load
+//and a mask, the size is kept by counting bits, and iteration skips to the
+//next set bit. Values outside of the window cannot be added.
+//Addresses come from a table holding every value of the window once, shared
+//by all the domains of a value type and window, so the window is capped at
+//2^20 values.
+template<long long Min, long long Max>
+struct BitsetStorage {
+    static_assert(Min <= Max, "A BitsetStorage window needs Min <= Max.");
+    static_assert(static_cast<unsigned long long>(Max) - static_cast<unsigned long long>(Min)
+        < (1ULL << 20), "A BitsetStorage window holds at most 2^20 values.");
+
+    template<class value_type, class Compare, class Allocator>
+    class storage;
+};
+
+//Sorted, disjoint closed intervals of an integral value type, for domains
+//made of a few long runs of values. Adjacent and overlapping intervals are
+//merged, lookups are a binary search over the interval starts, and memory
+//grows with the number of intervals rather than of values.
+//A value only gets an address, in a node of its own, once it is added on
+//its own or a variable is assigned to it; those nodes go away when the
+//value leaves the domain. Iteration yields copies of the values.
+struct IntervalStorage {
+    template<class value_type, class Compare, class Allocator>
+    class storage;
+};
+
+//Up to N values kept inside the storage object itself, spilling over into
+//a Spill storage only once those slots are taken, so small domains cost no
+//allocation at all. Values never move between the two: a value added while
+//the slots were full stays in Spill.
+//The slots are searched linearly; for arithmetic types ordered by std::less
+//all N of them are compared at once, which compilers turn into vector
+//compares. Iteration order is unspecified.
+template<std::size_t N = 16, class Spill = SetStorage>
+struct SmallStorage {
+    static_assert(N > 0 && N <= 64, "A SmallStorage holds between 1 and 64 values inline.");
+
+    template<class value_type, class Compare, class Allocator>
+    class storage;
+};
+
+#if __cplusplus >= 201703L
+//Interns std::string_view values: the characters of every value added are
+//copied into a chunked arena, and the Inner storage (a HashStorage unless
+//told otherwise) only keeps views of those copies. A value costs its
+//characters and one view instead of a std::string and its allocations.
+//The characters of removed values are given back with the domain.
+template<class Inner = HashStorage<>>
+struct InternedStorage {
+    template<class value_type, class Compare, class Allocator>
+    class storage;
+};
+#endif
+
+#if __cplusplus >= 201703L
+//The Inner storage, in a VariableDomain that can be shared between threads.
+//The domain guards itself with a std::shared_mutex: lookups (isAllowedValue,
+//allowedValues, useCount, resolve) and reads of variables take it shared,
+//while changes to the domain and to its variables, with the notices and
+//listener calls they cause, take it exclusively, one at a time.
+//A lookup that has to rebuild the Eytzinger index or the Bloom filter
+//after a change takes the lock exclusively, once; the Bloom filter does
+//not count its lookups. Iterators and the references returned by value()
+//are not protected: they are only valid as long as no other thread
+//changes the domain. Listeners are called with the lock held, so they must
+//not use the domain. Materialized storages (IntervalStorage) are not
+//supported, as their lookups write.
+template<class Inner = SetStorage>
+struct ConcurrentStorage {
+    template<class value_type, class Compare, class Allocator>
+    class storage;
+};
+#endif
+
+//The values given as template arguments, in a constant array searched
+//without branches. Nothing can be added or removed.
+//The values have to be listed in ascending order, without repetitions.
+template<class T, T... values>
+struct StaticStorage {
+    static_assert(sizeof...(values) > 0,
+        "A StaticStorage needs at least one value.");
+    static_assert(drv_detail::static_values<T, values...>::ascending(),
+        "StaticStorage values must be listed in ascending order, without repetitions.");
+
+    static constexpr T allowed_values[sizeof...(values)] = {values...};
+
+    template<class value_type, class Compare, class Allocator>
+    class storage;
+};
+
+template<class T, T... values>
+constexpr T StaticStorage<T, values...>::allowed_values[sizeof...(values)];
+
+template<class value_type, class Compare, class Allocator>
+class SetStorage::storage {
+    using set_type = std::set<value_type, Compare, drv_detail::rebind_alloc<Allocator, value_type>>;
+
+    public:
+    using hasher = typename drv_detail::compare_hash<value_type, Compare>::type;
+    using key_equal = drv_detail::equivalent<value_type, Compare>;
+
+    using const_iterator = typename set_type::const_iterator;
+    using const_reverse_iterator = typename set_type::const_reverse_iterator;
+
+    storage(const Compare& comp, const Allocator& alloc);
+    template<class InputIt>
+    storage(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc);
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    std::size_t size() const;
+
+    template<class K>
+    const value_type* find(const K& key) const;
+
+    template<class... Args>
+    std::pair<const value_type*, bool> emplace(Args&&... args);
+    void erase(const value_type* value);
+
+    hasher hash_function() const;
+    key_equal key_eq() const;
+
+    private:
+    set_type m_values;
+};
+
+template<class value_type, class Compare, class Allocator>
+class FlatStorage::storage {
+    using pointer_vector = std::vector<
+        const value_type*, drv_detail::rebind_alloc<Allocator, const value_type*>>;
+
+    public:
+    using hasher = typename drv_detail::compare_hash<value_type, Compare>::type;
+    using key_equal = drv_detail::equivalent<value_type, Compare>;
+
+    using const_iterator = drv_detail::indirect_iterator<
+        value_type, typename pointer_vector::const_iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    storage(const Compare& comp, const Allocator& alloc);
+    template<class InputIt>
+    storage(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc);
+
+    storage(storage&& other) = default;
+    storage& operator=(storage&& other) = delete;
+
+    ~storage();
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    std::size_t size() const;
+
+    template<class K>
+    const value_type* find(const K& key) const;
+
+    template<class... Args>
+    std::pair<const value_type*, bool> emplace(Args&&... args);
+    void erase(const value_type* value);
+
+    hasher hash_function() const;
+    key_equal key_eq() const;
+
+    private:
+    Compare m_comp;
+    //Copies of the values, kept sorted and contiguous for the search
+    std::vector<value_type, drv_detail::rebind_alloc<Allocator, value_type>> m_keys;
+    //m_values[i] is the stable address of the value equal to m_keys[i]
+    pointer_vector m_values;
+    drv_detail::value_pool<value_type, Allocator> m_pool;
+
+    const value_type* find(const value_type& key, std::true_type) const;
+    template<class K>
+    const value_type* find(const K& key, std::true_type) const;
+    template<class K>
+    const value_type* find(const K& key, std::false_type) const;
+};
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+class HashStorage<Hash, KeyEqual>::storage {
+    using pointer_vector = std::vector<
+        const value_type*, drv_detail::rebind_alloc<Allocator, const value_type*>>;
+
+    public:
+    using hasher = typename std::conditional<
+        std::is_void<Hash>::value, std::hash<value_type>, Hash>::type;
+    using key_equal = typename std::conditional<
+        std::is_void<KeyEqual>::value, std::equal_to<value_type>, KeyEqual>::type;
+
+    using const_iterator = drv_detail::indirect_iterator<
+        value_type, typename pointer_vector::const_iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    storage(const Compare& comp, const Allocator& alloc);
+    template<class InputIt>
+    storage(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc);
+
+    storage(storage&& other) = default;
+    storage& operator=(storage&& other) = delete;
+
+    ~storage();
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    std::size_t size() const;
+
+    template<class K>
+    const value_type* find(const K& key) const;
+
+    template<class... Args>
+    std::pair<const value_type*, bool> emplace(Args&&... args);
+    void erase(const value_type* value);
+
+    hasher hash_function() const;
+    key_equal key_eq() const;
+
+    private:
+    struct entry {
+        //nullptr marks an empty bucket
+        const value_type* value;
+        //Mixed hash of the value, also giving its home bucket
+        std::uint32_t hash;
+        //Position of the value inside m_values
+        std::uint32_t index;
+    };
+
+    hasher m_hash;
+    key_equal m_equal;
+    //Power of two sized, at most three quarters full
+    std::vector<entry, drv_detail::rebind_alloc<Allocator, entry>> m_table;
+    //Dense list of the values, for iteration
+    pointer_vector m_values;
+    drv_detail::value_pool<value_type, Allocator> m_pool;
+
+    template<class K>
+    std::uint32_t hashOf(const K& key) const;
+    template<class K>
+    std::size_t probe(const K& key, std::uint32_t hash) const;
+    std::size_t bucketOf(const value_type* value) const;
+    void grow();
+
+    template<class K>
+    const value_type* find(const K& key, std::true_type) const;
+    template<class K>
+    const value_type* find(const K& key, std::false_type) const;
+};
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+class StaticStorage<T, values...>::storage {
+    static_assert(std::is_same<T, value_type>::value
+        && std::is_same<Compare, std::less<value_type>>::value,
+        "StaticStorage is only usable with its own value type and std::less.");
+
+    public:
+    static const bool fixed = true;
+
+    using hasher = drv_detail::hash_or_unhashable<value_type>;
+    using key_equal = drv_detail::equivalent<value_type, Compare>;
+
+    using const_iterator = const value_type*;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    storage(const Compare& comp, const Allocator& alloc);
+    template<class InputIt>
+    storage(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc);
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    std::size_t size() const;
+
+    template<class K>
+    const value_type* find(const K& key) const;
+
+    //Only there to satisfy the storage interface: always refuses
+    template<class... Args>
+    std::pair<const value_type*, bool> emplace(Args&&... args);
+    void erase(const value_type* value);
+
+    hasher hash_function() const;
+    key_equal key_eq() const;
+};
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+class BitsetStorage<Min, Max>::storage {
+    static_assert(std::is_integral<value_type>::value
+        && std::is_same<Compare, std::less<value_type>>::value,
+        "BitsetStorage needs an integral value type ordered by std::less.");
+
+    static const std::size_t window = static_cast<std::size_t>(
+        static_cast<unsigned long long>(Max) - static_cast<unsigned long long>(Min)) + 1;
+
+    public:
+    using hasher = drv_detail::hash_or_unhashable<value_type>;
+    using key_equal = drv_detail::equivalent<value_type, Compare>;
+
+    using const_iterator = drv_detail::bitset_iterator<value_type>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    storage(const Compare& comp, const Allocator& alloc);
+    template<class InputIt>
+    storage(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc);
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    std::size_t size() const;
+
+    template<class K>
+    const value_type* find(const K& key) const;
+
+    template<class... Args>
+    std::pair<const value_type*, bool> emplace(Args&&... args);
+    void erase(const value_type* value);
+
+    hasher hash_function() const;
+    key_equal key_eq() const;
+
+    private:
+    std::vector<std::uint64_t, drv_detail::rebind_alloc<Allocator, std::uint64_t>> m_words;
+    std::size_t m_size;
+
+    //Every value of the window, in order
+    static const value_type* table();
+    //Position of value inside the window, or window if it is outside
+    static std::size_t offsetOf(value_type value);
+};
+
+template<class value_type, class Compare, class Allocator>
+class IntervalStorage::storage {
+    static_assert(std::is_integral<value_type>::value
+        && std::is_same<Compare, std::less<value_type>>::value,
+        "IntervalStorage needs an integral value type ordered by std::less.");
+
+    public:
+    static const bool materialized = true;
+
+    using hasher = drv_detail::hash_or_unhashable<value_type>;
+    using key_equal = drv_detail::equivalent<value_type, Compare>;
+
+    using const_iterator = drv_detail::interval_iterator<value_type>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    storage(const Compare& comp, const Allocator& alloc);
+    template<class InputIt>
+    storage(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc);
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    std::size_t size() const;
+
+    template<class K>
+    bool contains(const K& key) const;
+    //The address of the value, if it is allowed and was given one
+    template<class K>
+    const value_type* find(const K& key) const;
+    //Gives the value an address if it is allowed
+    template<class K>
+    const value_type* materialize(const K& key);
+
+    template<class... Args>
+    std::pair<const value_type*, bool> emplace(Args&&... args);
+    void erase(const value_type* value);
+
+    //Both return whether any value was added or removed. eraseInterval calls
+    //on_erase with every value in [lo, hi] that has an address, before that
+    //address goes away.
+    bool insertInterval(value_type lo, value_type hi);
+    template<class OnErase>
+    bool eraseInterval(value_type lo, value_type hi, OnErase on_erase);
+
+    hasher hash_function() const;
+    key_equal key_eq() const;
+
+    private:
+    using value_vector = std::vector<value_type, drv_detail::rebind_alloc<Allocator, value_type>>;
+
+    value_vector m_starts;
+    value_vector m_ends;
+    std::size_t m_size;
+
+    std::set<value_type, Compare, drv_detail::rebind_alloc<Allocator, value_type>> m_materialized;
+
+    //Index of the interval holding value, or the interval count
+    std::size_t intervalOf(value_type value) const;
+    static std::size_t width(value_type lo, value_type hi);
+};
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+class SmallStorage<N, Spill>::storage {
+    using spill_type = typename Spill::template storage<value_type, Compare, Allocator>;
+
+    static_assert(!drv_detail::is_materialized<spill_type>::value
+        && !drv_detail::is_fixed<spill_type>::value,
+        "A SmallStorage needs a Spill storage that holds its values.");
+
+    union slot {
+        slot() {}
+        ~slot() {}
+        value_type value;
+    };
+
+    //Whether every slot holds a value at all times, so that all of them
+    //can be compared without looking at which are occupied
+    static const bool scan_all = std::is_arithmetic<value_type>::value
+        && std::is_same<Compare, std::less<value_type>>::value;
+
+    public:
+    using hasher = typename spill_type::hasher;
+    using key_equal = typename spill_type::key_equal;
+
+    using const_iterator = drv_detail::small_iterator<
+        value_type, typename spill_type::const_iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    storage(const Compare& comp, const Allocator& alloc);
+    template<class InputIt>
+    storage(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc);
+
+    storage(storage&& other);
+    storage& operator=(storage&& other) = delete;
+
+    ~storage();
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    std::size_t size() const;
+
+    template<class K>
+    const value_type* find(const K& key) const;
+
+    template<class... Args>
+    std::pair<const value_type*, bool> emplace(Args&&... args);
+    void erase(const value_type* value);
+
+    hasher hash_function() const;
+    key_equal key_eq() const;
+
+    private:
+    Compare m_comp;
+    slot m_slots[N];
+    std::uint64_t m_occupied;
+    spill_type m_spill;
+
+    //Index of the slot holding key, or N
+    template<class K>
+    std::size_t slotOf(const K& key) const;
+    std::size_t slotOf(const value_type& key, std::true_type) const;
+    template<class K>
+    std::size_t slotOf(const K& key, std::true_type) const;
+    template<class K>
+    std::size_t slotOf(const K& key, std::false_type) const;
+};
+
+#if __cplusplus >= 201703L
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+class ConcurrentStorage<Inner>::storage:
+    public Inner::template storage<value_type, Compare, Allocator>
+{
+    using inner_type = typename Inner::template storage<value_type, Compare, Allocator>;
+
+    static_assert(!drv_detail::is_materialized<inner_type>::value,
+        "A ConcurrentStorage cannot wrap a materialized storage.");
+
+    public:
+    static const bool concurrent = true;
+
+    using inner_type::inner_type;
+};
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+class InternedStorage<Inner>::storage {
+    static_assert(std::is_same<value_type, std::string_view>::value,
+        "InternedStorage only holds std::string_view values.");
+
+    using inner_type = typename Inner::template storage<value_type, Compare, Allocator>;
+
+    //Strings longer than a quarter of a chunk get a chunk of their own
+    static const std::size_t chunk_size = 64 * 1024;
+
+    public:
+    using hasher = typename inner_type::hasher;
+    using key_equal = typename inner_type::key_equal;
+
+    using const_iterator = typename inner_type::const_iterator;
+    using const_reverse_iterator = typename inner_type::const_reverse_iterator;
+
+    storage(const Compare& comp, const Allocator& alloc);
+    template<class InputIt>
+    storage(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc);
+
+    storage(storage&& other) = default;
+    storage& operator=(storage&& other) = delete;
+
+    ~storage();
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    std::size_t size() const;
+
+    template<class K>
+    const value_type* find(const K& key) const;
+
+    template<class... Args>
+    std::pair<const value_type*, bool> emplace(Args&&... args);
+    void erase(const value_type* value);
+
+    hasher hash_function() const;
+    key_equal key_eq() const;
+
+    private:
+    inner_type m_views;
+
+    struct chunk {
+        char* data;
+        std::size_t size;
+    };
+    using char_allocator = drv_detail::rebind_alloc<Allocator, char>;
+
+    char_allocator m_alloc;
+    std::vector<chunk, drv_detail::rebind_alloc<Allocator, chunk>> m_chunks;
+    char* m_cursor;
+    std::size_t m_remaining;
+
+    char* allocateChunk(std::size_t size);
+
+    //A view of a copy of value in the arena
+    std::string_view intern(std::string_view value);
+};
+#endif
+
+//How a VariableDomain answers lookups on top of its storage
+enum class LookupAcceleration {
+    //Straight from the storage
+    none,
+    //From an Eytzinger layout copy of the values, see setLookupAcceleration
+    eytzinger
+};
+
+//What the Bloom filter of a VariableDomain did with the lookups it saw
+struct BloomFilterStats {
+    //Turned away without looking at the storage
+    std::uint64_t rejected;
+    //Let through, and found in the storage
+    std::uint64_t hits;
+    //Let through, but not found: false positives
+    std::uint64_t misses;
+};
+
+//What one mutation, or one batch of them, did to a VariableDomain, as
+//handed to its listeners. Each list is in the order the changes were made;
+//a value added and then removed within a batch shows up in both.
+template<class value_type>
+struct DomainChanges {
+    std::vector<value_type> added;
+    std::vector<value_type> removed;
+    //(to_replace, replacement)
+    std::vector<std::pair<value_type, value_type>> replaced;
+    //Closed intervals as given to addAllowedInterval and removeAllowedInterval,
+    //rather than every value in them
+    std::vector<std::pair<value_type, value_type>> added_intervals;
+    std::vector<std::pair<value_type, value_type>> removed_intervals;
+
+    bool empty() const {
+        return added.empty() && removed.empty() && replaced.empty()
+            && added_intervals.empty() && removed_intervals.empty();
+    }
+};
+
+template<
+    class value_type,
+    class Compare = std::less<value_type>,
+    class Storage = SetStorage,
+    class Allocator = std::allocator<value_type>>
+class DomainRestrictedVariable;
+
+template<
+    class value_type,
+    class Compare = std::less<value_type>,
+    class Storage = SetStorage,
+    class Allocator = std::allocator<value_type>>
+class LazyDomainRestrictedVariable;
+
+template<
+    class value_type,
+    class Compare = std::less<value_type>,
+    class Storage = SetStorage,
+    class Allocator = std::allocator<value_type>>
+class DomainValueRef;
+
+#if __cplusplus >= 201703L
+template<
+    class value_type,
+    class Compare = std::less<value_type>,
+    class Storage = SetStorage,
+    class Allocator = std::allocator<value_type>>
+class AtomicDomainRestrictedVariable;
+#endif
+
+template<
+    class value_type,
+    class Compare = std::less<value_type>,
+    class Storage = SetStorage,
+    class Allocator = std::allocator<value_type>>
+class DomainSnapshot;
+
+template<
+    class value_type,
+    class Compare = std::less<value_type>,
+    class Storage = SetStorage,
+    class Allocator = std::allocator<value_type>>
+class VariableDomain {
+    friend class DomainRestrictedVariable<value_type, Compare, Storage, Allocator>;
+    friend class LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>;
+#if __cplusplus >= 201703L
+    friend class AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>;
+    template<class, class, class, class, class>
+    friend class ShardedVariableDomain;
+#endif
+    using storage_type = typename Storage::template storage<value_type, Compare, Allocator>;
+    using variable_type = DomainRestrictedVariable<value_type, Compare, Storage, Allocator>;
+    using frozen_index_type = drv_detail::perfect_hash_index<
+        value_type,
+        typename storage_type::hasher,
+        typename storage_type::key_equal>;
+    using bloom_filter_type = drv_detail::blocked_bloom_filter<
+        value_type,
+        typename storage_type::hasher>;
+    using lazy_variable_type = LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>;
+    using holder_list = drv_detail::holder_list<value_type>;
+    using holder_list_allocator = drv_detail::rebind_alloc<Allocator, holder_list>;
+    //A value and one of the generation slots pointing at it
+    using slot_key = std::pair<const value_type*, std::size_t>;
+
+    static const bool concurrent = drv_detail::is_concurrent<storage_type>::value;
+    using mutex_type = drv_detail::domain_mutex<concurrent>;
+    using exclusive_guard = drv_detail::exclusive_guard<mutex_type>;
+    using shared_guard = drv_detail::shared_guard<mutex_type>;
+    using read_guard = drv_detail::read_guard<mutex_type>;
+    using snapshot_reclaimer = drv_detail::epoch_reclaimer<std::vector<value_type>>;
+
+    //Whether isAllowedValues works on the sorted snapshot
+    static const bool sorted_batches = std::is_integral<value_type>::value
+        && std::is_same<Compare, std::less<value_type>>::value
+        && !drv_detail::is_materialized<storage_type>::value;
+
+    public:
+    using const_iterator = typename storage_type::const_iterator;
+    using const_reverse_iterator = typename storage_type::const_reverse_iterator;
+    using allocator_type = Allocator;
+    using change_listener = std::function<void(const DomainChanges<value_type>&)>;
+
+    //The storage and the registry of subscribed variables allocate through
+    //alloc
+    VariableDomain(
+        std::initializer_list<value_type> ilist = {},
+        const Compare& comp = Compare(),
+        const Allocator& alloc = Allocator()
+    );
+    explicit VariableDomain(
+        const Compare& comp,
+        const Allocator& alloc = Allocator()
+    );
+    explicit VariableDomain(
+        const Allocator& alloc
+    );
+    template<class InputIt>
+    VariableDomain(
+        InputIt first, InputIt last,
+        const Compare& comp = Compare(),
+        const Allocator& alloc = Allocator()
+    );
+
+    VariableDomain(const VariableDomain& other) = delete;
+    VariableDomain(VariableDomain&& other) = default;
+
+    VariableDomain& operator=(const VariableDomain& other) = delete;
+    VariableDomain& operator=(VariableDomain&& other) = delete;
+
+    ~VariableDomain() noexcept(false);
+
+    //Iterator
+    const_iterator begin() const;
+    const_iterator cbegin() const;
+    const_iterator end() const;
+    const_iterator cend() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator rend() const;
+    const_reverse_iterator crend() const;
+
+    //Check
+    bool isAllowedValue(const value_type& value) const;
+#if __cplusplus >= 201402L
+    template<class K>
+    bool isAllowedValue(K&& x) const;
+#endif
+
+    //Sets bit i % 64 of bitmask_out[i / 64] if values[i] is allowed, and
+    //clears it otherwise, writing (count + 63) / 64 words in total.
+    //Integral domains ordered by std::less compare whole vectors of values
+    //against a sorted snapshot of the domain, rebuilt after changes.
+    void isAllowedValues(
+        const value_type* values, std::size_t count,
+        std::uint64_t* bitmask_out
+    ) const;
+#if __cplusplus >= 202002L
+    void isAllowedValues(
+        std::span<const value_type> values,
+        std::uint64_t* bitmask_out
+    ) const;
+#endif
+
+    //Addition
+    bool addAllowedValue(const value_type& value);
+    bool addAllowedValue(value_type&& value);
+    template<class InputIt>
+    void addAllowedValuesRange(InputIt first, InputIt last);
+    void addAllowedValues(std::initializer_list<value_type> ilist);
+
+    template<class... Args>
+    bool emplaceAllowedValue(Args&&... args);
+
+    //Removal
+    //The batch versions visit the holders of each removed value once, and
+    //bring the lookup accelerators up to date once for the whole batch.
+    bool removeAllowedValue(const value_type& value);
+    template<class InputIt>
+    void removeAllowedValuesRange(InputIt first, InputIt last);
+    void removeAllowedValues(std::initializer_list<value_type> ilist);
+
+    //Replacement
+    bool replaceAllowedValue(
+        const value_type& to_replace,
+        const value_type& replacement
+    );
+    bool replaceAllowedValue(
+        const value_type& to_replace,
+        value_type&& replacement
+    );
+    //Applies each (to_replace, replacement) pair of a remap table (a
+    //std::map, or any range of std::pairs) in order, as replaceAllowedValue
+    //would, so a -> b followed by b -> c sends the holders of a to c
+    template<class InputIt>
+    void replaceAllowedValuesRange(InputIt first, InputIt last);
+    void replaceAllowedValues(std::initializer_list<std::pair<value_type, value_type>> remap);
+
+    //Intervals
+    //Only available with IntervalStorage. Both return whether the domain
+    //changed; removing an interval clears exactly the variables holding one
+    //of its values.
+    bool addAllowedInterval(const value_type& lo, const value_type& hi);
+    bool removeAllowedInterval(const value_type& lo, const value_type& hi);
+
+    //Retrieval
+    std::vector<value_type> allowedValues() const;
+    allocator_type get_allocator() const;
+
+    //Usage
+    //The domain counts the DomainRestrictedVariables holding each value as
+    //they are assigned, copied, moved and cleared, so none of these look at
+    //the variables themselves. Lazy variables are not counted.
+    std::size_t useCount(const value_type& value) const;
+    //Values no variable holds, in iteration order
+    std::vector<value_type> unusedValues() const;
+    //Every value held by at least one variable, with the number of its
+    //holders, in no particular order
+    std::vector<std::pair<value_type, std::size_t>> useCounts() const;
+    //Removes value only if no variable holds it
+    bool removeAllowedValueIfUnused(const value_type& value);
+
+    //References
+    //A null reference if value is not allowed. Throws std::length_error
+    //once the domain has handed out 2^32 generation slots. Takes the
+    //exclusive lock only the first time value gets a reference.
+    DomainValueRef<value_type, Compare, Storage, Allocator> makeRef(const value_type& value);
+    //The referenced value, or null if the reference is null or its value
+    //left the domain since it was made. Takes no lock.
+    const value_type* resolve(DomainValueRef<value_type, Compare, Storage, Allocator> ref) const;
+
+    //Freezing
+    //A frozen domain answers lookups through a minimal perfect hash and
+    //refuses every change: the bool mutators return false, the others throw
+    //std::logic_error. Values do not move, so variables are unaffected.
+    //Domains over a fixed storage (StaticStorage) are always frozen.
+    void freeze();
+    void thaw();
+    bool isFrozen() const;
+
+    //Lookup acceleration
+    //With LookupAcceleration::eytzinger, lookups search a copy of the values
+    //in Eytzinger layout, without branches, rebuilt on the first lookup after
+    //a change. Meant for large domains that are read far more often than
+    //they are changed. A frozen domain's perfect hash takes precedence, and
+    //materialized storages (IntervalStorage) keep answering lookups themselves.
+    void setLookupAcceleration(LookupAcceleration acceleration);
+    LookupAcceleration lookupAcceleration() const;
+
+    //Bloom filter
+    //A blocked Bloom filter in front of every lookup (isAllowedValue, and
+    //assignments to variables) turns most values outside of the domain away
+    //after reading one cache line. It is sized for twice the values of the
+    //domain and added values are fed to it as they come; after a removal, or
+    //once it is full, it is rebuilt on the next lookup. false_positive_rate is the share of
+    //outside values it should let through. Needs the same hash as freeze()
+    //(see CompareHash), as a hash that disagrees with Compare would turn
+    //allowed values away. Not available with materialized storages
+    //(IntervalStorage).
+    void enableBloomFilter(double false_positive_rate = 0.01);
+    void disableBloomFilter();
+    bool isBloomFilterEnabled() const;
+
+    BloomFilterStats bloomFilterStats() const;
+    void resetBloomFilterStats();
+
+    //Snapshots
+    //Once enabled, every mutation (or batch of them) publishes a sorted copy
+    //of the values, which threads that only read can take through snapshot()
+    //without any lock, even while another thread changes the domain. Copies
+    //replaced while readers still hold them are freed once those readers
+    //are done; beyond 64 snapshots held at once, none is freed until the
+    //extra ones are released. Variables hold the domain's own values, so
+    //publishing leaves them alone.
+    //Enable snapshots before sharing the domain. snapshot() throws
+    //std::logic_error if they are not enabled, and the domain has to outlive
+    //the snapshots taken from it.
+    void enableSnapshots();
+    void disableSnapshots();
+    DomainSnapshot<value_type, Compare, Storage, Allocator> snapshot() const;
+
+    //Listeners
+    //A listener is called once per mutation with everything it changed. The
+    //range, initializer_list and interval mutators count as one mutation, and
+    //so does everything between beginChangeBatch() and the matching
+    //endChangeBatch() (batches nest). Changes are only recorded while there
+    //are listeners. addListener returns an id for removeListener.
+    std::size_t addListener(change_listener listener);
+    bool removeListener(std::size_t id);
+    void beginChangeBatch();
+    void endChangeBatch();
+
+    private:
+    //Only locks anything in domains over a ConcurrentStorage
+    mutable mutex_type m_mutex;
+
+    storage_type m_allowed_values;
+
+    bool m_frozen;
+    //Null while thawed, or if no perfect hash could be built for the values
+    std::unique_ptr<const frozen_index_type> m_frozen_index;
+
+    //Sorted copy of the values for isAllowedValues, rebuilt lazily
+    mutable std::vector<value_type> m_sorted_snapshot;
+    mutable bool m_sorted_snapshot_stale;
+
+    LookupAcceleration m_lookup_acceleration;
+    //Rebuilt lazily, like the sorted snapshot
+    mutable drv_detail::eytzinger_index<value_type, Compare> m_eytzinger_index;
+    mutable bool m_eytzinger_index_stale;
+
+    bool m_bloom_filter_enabled;
+    double m_bloom_filter_rate;
+    mutable bloom_filter_type m_bloom_filter;
+    mutable bool m_bloom_filter_stale;
+    mutable BloomFilterStats m_bloom_filter_stats;
+
+    std::vector<std::pair<std::size_t, change_listener>> m_listeners;
+    std::size_t m_next_listener_id;
+    unsigned m_change_batches;
+    //Recorded since the listeners were last called
+    DomainChanges<value_type> m_pending_changes;
+
+    //Created by the first enableSnapshots(), and kept until the domain goes
+    //away, as readers may still be using it after disableSnapshots()
+    std::unique_ptr<snapshot_reclaimer> m_snapshots;
+    bool m_snapshots_enabled;
+    bool m_snapshot_stale;
+
+    allocator_type m_allocator;
+    //Subscribed variables are linked into the list of the value they hold,
+    //and read their value from it. Subscribing, copying and unsubscribing a
+    //variable are a few pointer writes, and removing or replacing a value
+    //changes its list, not the variables in it: nothing walks the holders
+    //of a value unless two lists are merged. A value gets a list the first
+    //time it is held
+    std::size_t m_managed_variables;
+    holder_list m_unheld;
+    std::map<
+        const value_type*,
+        holder_list*,
+        std::less<const value_type*>,
+        drv_detail::rebind_alloc<Allocator, std::pair<const value_type* const, holder_list*>>
+    > m_holders;
+
+    //Generation slots of the values held by lazy variables, created on the
+    //first assignment of a value. A replaced value hands its slots over to
+    //the replacement, so a value may have more than one
+    drv_detail::slot_table<value_type, Allocator> m_slots;
+    std::vector<std::size_t, drv_detail::rebind_alloc<Allocator, std::size_t>> m_free_slots;
+    std::set<
+        slot_key,
+        drv_detail::address_pair_less,
+        drv_detail::rebind_alloc<Allocator, slot_key>> m_value_slots;
+
+    //Whether a lookup would rebuild the Eytzinger index or the Bloom filter
+    bool lookupStale() const;
+
+    //Materialized storages (IntervalStorage) only find values that were
+    //given an address, which locateAddress and findStored do first; only
+    //changes and assignments, which need the address, use them
+    template<class K>
+    const value_type* locate(const K& key) const;
+    template<class K>
+    const value_type* locateAddress(const K& key);
+    //The value in the storage itself, past the Bloom filter and the indexes
+    template<class K>
+    const value_type* findStored(const K& key);
+    template<class K>
+    const value_type* findStored(const K& key, std::true_type);
+    template<class K>
+    const value_type* findStored(const K& key, std::false_type);
+    //locate without the Bloom filter
+    template<class K>
+    const value_type* lookup(const K& key) const;
+    template<class K>
+    const value_type* locateAccelerated(const K& key, std::true_type) const;
+    template<class K>
+    const value_type* locateAccelerated(const K& key, std::false_type) const;
+    template<class K>
+    bool contains(const K& key, std::true_type) const;
+    template<class K>
+    bool contains(const K& key, std::false_type) const;
+
+    //The mutators, without locking
+    template<class T>
+    bool add(T&& value);
+    bool remove(const value_type& value);
+    template<class T>
+    bool replace(const value_type& to_replace, T&& replacement);
+
+    void throwIfFrozen() const;
+
+    void buildFrozenIndex(std::true_type);
+    void buildFrozenIndex(std::false_type);
+
+    //Every change to the values has to go through here, once per mutation;
+    //it also calls the listeners unless a batch is open
+    void valuesChanged();
+    //Values added, removed or replaced one by one also go through these, for
+    //the Bloom filter and the listeners. A removed value has to be passed in
+    //before it is erased
+    void valueAdded(const value_type& value);
+    void valueRemoved(const value_type& value);
+    void valueReplaced(const value_type& to_replace, const value_type& replacement);
+    void publishChanges();
+    void publishSnapshot();
+
+    const bloom_filter_type& bloomFilter() const;
+
+    const std::vector<value_type>& sortedSnapshot() const;
+
+    void isAllowedValues(
+        const value_type* values, std::size_t count,
+        std::uint64_t* bitmask_out,
+        std::true_type
+    ) const;
+    void isAllowedValues(
+        const value_type* values, std::size_t count,
+        std::uint64_t* bitmask_out,
+        std::false_type
+    ) const;
+
+    void subscribeVariable(variable_type* const ptr, const value_type* value);
+    //Subscribes ptr, a copy of other, without looking its value up
+    void subscribeCopy(variable_type* const ptr, const variable_type* other);
+    void unsubscribeVariable(variable_type* const ptr);
+    //Points a subscribed variable at value
+    void reassignVariable(variable_type* const ptr, const value_type* value);
+    //The list of the variables holding value, created if it has none
+    holder_list& holdersOf(const value_type* value);
+    //Frees list if its value left the domain and it has no variable left
+    void releaseIfOrphaned(holder_list* list);
+    std::size_t useCountOf(const value_type* value) const;
+    std::vector<value_type> unusedValues(std::true_type) const;
+    std::vector<value_type> unusedValues(std::false_type) const;
+
+    //The slot of value, created if it has none
+    std::size_t slotOf(const value_type* value);
+    //The slot of value, or SIZE_MAX if it has none
+    std::size_t findSlot(const value_type* value) const;
+    //The value of slot, or null if it left the domain since generation.
+    //Safe without the lock, see below
+    const value_type* resolveSlot(std::size_t slot, std::uint64_t generation) const;
+    DomainValueRef<value_type, Compare, Storage, Allocator> refTo(std::size_t slot) const;
+
+    void deletionNotice(const value_type* to_delete);
+    void replacementNotice(
+        const value_type* to_replace,
+        const value_type* replacement
+    );
+};
+
+template<class value_type, class Compare, class Storage, class Allocator>
+class DomainRestrictedVariable: private drv_detail::list_hook {
+    friend class VariableDomain<value_type, Compare, Storage, Allocator>;
+
+    public:
+    DomainRestrictedVariable(
+        VariableDomain<value_type, Compare, Storage, Allocator>& domain,
+        const value_type& value
+    );
+    DomainRestrictedVariable(
+        VariableDomain<value_type, Compare, Storage, Allocator>& domain
+    );
+
+    DomainRestrictedVariable(const DomainRestrictedVariable& other);
+    DomainRestrictedVariable(DomainRestrictedVariable&& other);
+
+    ~DomainRestrictedVariable();
+
+    DomainRestrictedVariable& operator=(const DomainRestrictedVariable& other);
+    DomainRestrictedVariable& operator=(DomainRestrictedVariable&& other);
+    DomainRestrictedVariable& operator=(const value_type& value);
+
+    void clear();
+    bool has_value() const;
+
+    const value_type& value() const;
+
+    //WARNING:  If the variable is uninitialized or cleared
+    //          this method has undefined behaviour
+    operator const value_type&() const;
+
+    template<class T, class C, class S, class A>
+    friend bool operator==(
+        const DomainRestrictedVariable<T, C, S, A>& lhs,
+        const DomainRestrictedVariable<T, C, S, A>& rhs
+    );
+
+    template<class T, class C, class S, class A>
+    friend bool operator!=(
+        const DomainRestrictedVariable<T, C, S, A>& lhs,
+        const DomainRestrictedVariable<T, C, S, A>& rhs
+    );
+
+    template<class T, class C, class S, class A>
+    friend bool operator<(
+        const DomainRestrictedVariable<T, C, S, A>& lhs,
+        const DomainRestrictedVariable<T, C, S, A>& rhs
+    );
+
+    template<class T, class C, class S, class A>
+    friend bool operator>(
+        const DomainRestrictedVariable<T, C, S, A>& lhs,
+        const DomainRestrictedVariable<T, C, S, A>& rhs
+    );
+
+    template<class T, class C, class S, class A>
+    friend bool operator<=(
+        const DomainRestrictedVariable<T, C, S, A>& lhs,
+        const DomainRestrictedVariable<T, C, S, A>& rhs
+    );
+
+    template<class T, class C, class S, class A>
+    friend bool operator>=(
+        const DomainRestrictedVariable<T, C, S, A>& lhs,
+        const DomainRestrictedVariable<T, C, S, A>& rhs
+    );
+
+    private:
+    using domain_type = VariableDomain<value_type, Compare, Storage, Allocator>;
+
+    std::reference_wrapper<VariableDomain<value_type, Compare, Storage, Allocator>> m_domain;
+    //The list of the variables holding the same value, which holds the
+    //value itself; set by the domain
+    drv_detail::holder_list<value_type>* m_list;
+
+    const value_type* get() const;
+    void assign(const value_type* value);
+};
+
+
+template<class value_type, class Compare, class Allocator>
+SetStorage::storage<value_type, Compare, Allocator>::storage(
+    const Compare& comp,
+    const Allocator& alloc
+): m_values(comp, alloc) {}
+
+template<class value_type, class Compare, class Allocator>
+template<class InputIt>
+SetStorage::storage<value_type, Compare, Allocator>::storage(
+    InputIt first, InputIt last,
+    const Compare& comp,
+    const Allocator& alloc
+): m_values(first, last, comp, alloc) {}
+
+template<class value_type, class Compare, class Allocator>
+typename SetStorage::storage<value_type, Compare, Allocator>::const_iterator
+    SetStorage::storage<value_type, Compare, Allocator>::begin() const
+{
+    return m_values.begin();
+}
+
+template<class value_type, class Compare, class Allocator>
+typename SetStorage::storage<value_type, Compare, Allocator>::const_iterator
+    SetStorage::storage<value_type, Compare, Allocator>::end() const
+{
+    return m_values.end();
+}
+
+template<class value_type, class Compare, class Allocator>
+typename SetStorage::storage<value_type, Compare, Allocator>::const_reverse_iterator
+    SetStorage::storage<value_type, Compare, Allocator>::rbegin() const
+{
+    return m_values.rbegin();
+}
+
+template<class value_type, class Compare, class Allocator>
+typename SetStorage::storage<value_type, Compare, Allocator>::const_reverse_iterator
+    SetStorage::storage<value_type, Compare, Allocator>::rend() const
+{
+    return m_values.rend();
+}
+
+template<class value_type, class Compare, class Allocator>
+std::size_t SetStorage::storage<value_type, Compare, Allocator>::size() const {
+    return m_values.size();
+}
+
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* SetStorage::storage<value_type, Compare, Allocator>::find(
+    const K& key
+) const {
+    auto iter = m_values.find(key);
+    return iter == m_values.end() ? nullptr : &*iter;
+}
+
+template<class value_type, class Compare, class Allocator>
+template<class... Args>
+std::pair<const value_type*, bool>
+    SetStorage::storage<value_type, Compare, Allocator>::emplace(
+    Args&&... args
+) {
+    auto pair = m_values.emplace(std::forward<Args>(args)...);
+    return std::make_pair(&*pair.first, pair.second);
+}
+
+template<class value_type, class Compare, class Allocator>
+void SetStorage::storage<value_type, Compare, Allocator>::erase(
+    const value_type* value
+) {
+    m_values.erase(*value);
+}
+
+template<class value_type, class Compare, class Allocator>
+typename SetStorage::storage<value_type, Compare, Allocator>::hasher
+    SetStorage::storage<value_type, Compare, Allocator>::hash_function() const
+{
+    return hasher();
+}
+
+template<class value_type, class Compare, class Allocator>
+typename SetStorage::storage<value_type, Compare, Allocator>::key_equal
+    SetStorage::storage<value_type, Compare, Allocator>::key_eq() const
+{
+    return key_equal(m_values.key_comp());
+}
+
+template<class value_type, class Compare, class Allocator>
+FlatStorage::storage<value_type, Compare, Allocator>::storage(
+    const Compare& comp,
+    const Allocator& alloc
+): m_comp(comp), m_keys(alloc), m_values(alloc), m_pool(alloc) {}
+
+template<class value_type, class Compare, class Allocator>
+template<class InputIt>
+FlatStorage::storage<value_type, Compare, Allocator>::storage(
+    InputIt first, InputIt last,
+    const Compare& comp,
+    const Allocator& alloc
+): storage(comp, alloc)
+{
+    for(; first != last; ++first) {
+        emplace(*first);
+    }
+}
+
+template<class value_type, class Compare, class Allocator>
+FlatStorage::storage<value_type, Compare, Allocator>::~storage() {
+    for(auto ptr : m_values) {
+        m_pool.destroy(ptr);
+    }
+}
+
+template<class value_type, class Compare, class Allocator>
+typename FlatStorage::storage<value_type, Compare, Allocator>::const_iterator
+    FlatStorage::storage<value_type, Compare, Allocator>::begin() const
+{
+    return const_iterator(m_values.begin());
+}
+
+template<class value_type, class Compare, class Allocator>
+typename FlatStorage::storage<value_type, Compare, Allocator>::const_iterator
+    FlatStorage::storage<value_type, Compare, Allocator>::end() const
+{
+    return const_iterator(m_values.end());
+}
+
+template<class value_type, class Compare, class Allocator>
+typename FlatStorage::storage<value_type, Compare, Allocator>::const_reverse_iterator
+    FlatStorage::storage<value_type, Compare, Allocator>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<class value_type, class Compare, class Allocator>
+typename FlatStorage::storage<value_type, Compare, Allocator>::const_reverse_iterator
+    FlatStorage::storage<value_type, Compare, Allocator>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<class value_type, class Compare, class Allocator>
+std::size_t FlatStorage::storage<value_type, Compare, Allocator>::size() const {
+    return m_values.size();
+}
+
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* FlatStorage::storage<value_type, Compare, Allocator>::find(
+    const K& key
+) const {
+    return find(key, std::integral_constant<bool,
+        drv_detail::is_transparent<Compare>::value || std::is_same<K, value_type>::value>());
+}
+
+template<class value_type, class Compare, class Allocator>
+const value_type* FlatStorage::storage<value_type, Compare, Allocator>::find(
+    const value_type& key,
+    std::true_type
+) const {
+    auto iter = std::lower_bound(m_keys.begin(), m_keys.end(), key, m_comp);
+    if(iter == m_keys.end() || m_comp(key, *iter)) {
+        return nullptr;
+    }
+    return m_values[iter - m_keys.begin()];
+}
+
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* FlatStorage::storage<value_type, Compare, Allocator>::find(
+    const K& key,
+    std::true_type
+) const {
+    auto iter = std::lower_bound(m_keys.begin(), m_keys.end(), key, m_comp);
+    if(iter == m_keys.end() || m_comp(key, *iter)) {
+        return nullptr;
+    }
+    return m_values[iter - m_keys.begin()];
+}
+
+//Without a transparent comparator the key is converted once up front,
+//rather than once per probe of the binary search
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* FlatStorage::storage<value_type, Compare, Allocator>::find(
+    const K& key,
+    std::false_type
+) const {
+    const value_type converted(key);
+    return find(converted, std::true_type());
+}
+
+template<class value_type, class Compare, class Allocator>
+template<class... Args>
+std::pair<const value_type*, bool>
+    FlatStorage::storage<value_type, Compare, Allocator>::emplace(
+    Args&&... args
+) {
+    const value_type* ptr = m_pool.create(std::forward<Args>(args)...);
+
+    auto iter = std::lower_bound(m_keys.begin(), m_keys.end(), *ptr, m_comp);
+    auto index = iter - m_keys.begin();
+    if(iter != m_keys.end() && !m_comp(*ptr, *iter)) {
+        m_pool.destroy(ptr);
+        return std::make_pair(m_values[index], false);
+    }
+
+    try {
+        m_keys.insert(iter, *ptr);
+        try {
+            m_values.insert(m_values.begin() + index, ptr);
+        } catch(...) {
+            m_keys.erase(m_keys.begin() + index);
+            throw;
+        }
+    } catch(...) {
+        m_pool.destroy(ptr);
+        throw;
+    }
+    return std::make_pair(ptr, true);
+}
+
+template<class value_type, class Compare, class Allocator>
+void FlatStorage::storage<value_type, Compare, Allocator>::erase(
+    const value_type* value
+) {
+    auto iter = std::lower_bound(m_keys.begin(), m_keys.end(), *value, m_comp);
+    auto index = iter - m_keys.begin();
+
+    m_keys.erase(iter);
+    m_values.erase(m_values.begin() + index);
+    m_pool.destroy(value);
+}
+
+template<class value_type, class Compare, class Allocator>
+typename FlatStorage::storage<value_type, Compare, Allocator>::hasher
+    FlatStorage::storage<value_type, Compare, Allocator>::hash_function() const
+{
+    return hasher();
+}
+
+template<class value_type, class Compare, class Allocator>
+typename FlatStorage::storage<value_type, Compare, Allocator>::key_equal
+    FlatStorage::storage<value_type, Compare, Allocator>::key_eq() const
+{
+    return key_equal(m_comp);
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::storage(
+    const Compare&,
+    const Allocator& alloc
+): m_hash(), m_equal(), m_table(alloc), m_values(alloc), m_pool(alloc) {}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+template<class InputIt>
+HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::storage(
+    InputIt first, InputIt last,
+    const Compare& comp,
+    const Allocator& alloc
+): storage(comp, alloc)
+{
+    for(; first != last; ++first) {
+        emplace(*first);
+    }
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::~storage() {
+    for(auto ptr : m_values) {
+        m_pool.destroy(ptr);
+    }
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+typename HashStorage<Hash, KeyEqual>::template storage<value_type, Compare, Allocator>::const_iterator
+    HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::begin() const
+{
+    return const_iterator(m_values.begin());
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+typename HashStorage<Hash, KeyEqual>::template storage<value_type, Compare, Allocator>::const_iterator
+    HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::end() const
+{
+    return const_iterator(m_values.end());
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+typename HashStorage<Hash, KeyEqual>::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+typename HashStorage<Hash, KeyEqual>::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+std::size_t HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::size() const {
+    return m_values.size();
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::find(
+    const K& key
+) const {
+    return find(key, std::integral_constant<bool,
+        (drv_detail::is_transparent<hasher>::value
+        && drv_detail::is_transparent<key_equal>::value)
+        || std::is_same<K, value_type>::value>());
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::find(
+    const K& key,
+    std::true_type
+) const {
+    if(m_table.empty()) {
+        return nullptr;
+    }
+    return m_table[probe(key, hashOf(key))].value;
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::find(
+    const K& key,
+    std::false_type
+) const {
+    const value_type converted(key);
+    return find(converted, std::true_type());
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+template<class... Args>
+std::pair<const value_type*, bool>
+    HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::emplace(
+    Args&&... args
+) {
+    const value_type* ptr = m_pool.create(std::forward<Args>(args)...);
+
+    try {
+        if((m_values.size() + 1) * 4 > m_table.size() * 3) {
+            grow();
+        }
+
+        std::uint32_t hash = hashOf(*ptr);
+        entry& slot = m_table[probe(*ptr, hash)];
+        if(slot.value != nullptr) {
+            m_pool.destroy(ptr);
+            return std::make_pair(slot.value, false);
+        }
+
+        m_values.push_back(ptr);
+        slot.value = ptr;
+        slot.hash = hash;
+        slot.index = static_cast<std::uint32_t>(m_values.size() - 1);
+    } catch(...) {
+        m_pool.destroy(ptr);
+        throw;
+    }
+    return std::make_pair(ptr, true);
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+void HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::erase(
+    const value_type* value
+) {
+    std::size_t mask = m_table.size() - 1;
+    std::size_t hole = bucketOf(value);
+    std::uint32_t index = m_table[hole].index;
+
+    //Keep m_values dense by moving its last element into the gap
+    if(index + 1 != m_values.size()) {
+        const value_type* last = m_values.back();
+        m_values[index] = last;
+        m_table[bucketOf(last)].index = index;
+    }
+    m_values.pop_back();
+
+    //Backward shift deletion, so no tombstones are needed
+    for(std::size_t next = (hole + 1) & mask;
+        m_table[next].value != nullptr;
+        next = (next + 1) & mask)
+    {
+        std::size_t home = m_table[next].hash & mask;
+        bool stays = hole <= next
+            ? hole < home && home <= next
+            : hole < home || home <= next;
+        if(!stays) {
+            m_table[hole] = m_table[next];
+            hole = next;
+        }
+    }
+    m_table[hole].value = nullptr;
+
+    m_pool.destroy(value);
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+typename HashStorage<Hash, KeyEqual>::template storage<value_type, Compare, Allocator>::hasher
+    HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::hash_function() const
+{
+    return m_hash;
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+typename HashStorage<Hash, KeyEqual>::template storage<value_type, Compare, Allocator>::key_equal
+    HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::key_eq() const
+{
+    return m_equal;
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+std::uint32_t HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::hashOf(
+    const K& key
+) const {
+    //Fibonacci hashing spreads the identity hashes of integers over the table
+    std::uint64_t hash = static_cast<std::uint64_t>(m_hash(key));
+    return static_cast<std::uint32_t>((hash * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+std::size_t HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::probe(
+    const K& key,
+    std::uint32_t hash
+) const {
+    std::size_t mask = m_table.size() - 1;
+    for(std::size_t bucket = hash & mask;; bucket = (bucket + 1) & mask) {
+        const entry& slot = m_table[bucket];
+        if(slot.value == nullptr
+            || (slot.hash == hash && m_equal(*slot.value, key)))
+        {
+            return bucket;
+        }
+    }
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+std::size_t HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::bucketOf(
+    const value_type* value
+) const {
+    std::size_t mask = m_table.size() - 1;
+    std::size_t bucket = hashOf(*value) & mask;
+    while(m_table[bucket].value != value) {
+        bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+}
+
+template<class Hash, class KeyEqual>
+template<class value_type, class Compare, class Allocator>
+void HashStorage<Hash, KeyEqual>::storage<value_type, Compare, Allocator>::grow() {
+    std::vector<entry, drv_detail::rebind_alloc<Allocator, entry>> table(
+        m_table.empty() ? 16 : m_table.size() * 2, entry(), m_table.get_allocator());
+    std::size_t mask = table.size() - 1;
+
+    for(auto& slot : m_table) {
+        if(slot.value == nullptr) {
+            continue;
+        }
+        std::size_t bucket = slot.hash & mask;
+        while(table[bucket].value != nullptr) {
+            bucket = (bucket + 1) & mask;
+        }
+        table[bucket] = slot;
+    }
+    m_table.swap(table);
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::storage(
+    const Compare&,
+    const Allocator& alloc
+): m_words((window + 63) / 64, 0, alloc), m_size(0) {}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+template<class InputIt>
+BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::storage(
+    InputIt first, InputIt last,
+    const Compare& comp,
+    const Allocator& alloc
+): storage(comp, alloc)
+{
+    for(; first != last; ++first) {
+        emplace(*first);
+    }
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+typename BitsetStorage<Min, Max>::template storage<value_type, Compare, Allocator>::const_iterator
+    BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::begin() const
+{
+    const_iterator last = end();
+    return const_iterator(m_words.data(), table(), window, last.next(0));
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+typename BitsetStorage<Min, Max>::template storage<value_type, Compare, Allocator>::const_iterator
+    BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::end() const
+{
+    return const_iterator(m_words.data(), table(), window, window);
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+typename BitsetStorage<Min, Max>::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+typename BitsetStorage<Min, Max>::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+std::size_t BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::size() const {
+    return m_size;
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::find(
+    const K& key
+) const {
+    //Integral keys are checked against the window before they are narrowed
+    using probe_type = typename std::conditional<std::is_integral<K>::value, K, value_type>::type;
+    probe_type probe = static_cast<probe_type>(key);
+    if(!drv_detail::in_window<Min, Max>(probe, std::is_signed<probe_type>())) {
+        return nullptr;
+    }
+    std::size_t offset = offsetOf(static_cast<value_type>(probe));
+    if(offset == window || (m_words[offset / 64] >> (offset % 64) & 1) == 0) {
+        return nullptr;
+    }
+    return table() + offset;
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+template<class... Args>
+std::pair<const value_type*, bool>
+    BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::emplace(
+    Args&&... args
+) {
+    std::size_t offset = offsetOf(value_type(std::forward<Args>(args)...));
+    if(offset == window) {
+        return std::pair<const value_type*, bool>(nullptr, false);
+    }
+
+    std::uint64_t& word = m_words[offset / 64];
+    std::uint64_t bit = UINT64_C(1) << (offset % 64);
+    bool inserted = (word & bit) == 0;
+    word |= bit;
+    m_size += inserted;
+    return std::make_pair(table() + offset, inserted);
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+void BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::erase(
+    const value_type* value
+) {
+    std::size_t offset = static_cast<std::size_t>(value - table());
+    m_words[offset / 64] &= ~(UINT64_C(1) << (offset % 64));
+    --m_size;
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+typename BitsetStorage<Min, Max>::template storage<value_type, Compare, Allocator>::hasher
+    BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::hash_function() const
+{
+    return hasher();
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+typename BitsetStorage<Min, Max>::template storage<value_type, Compare, Allocator>::key_equal
+    BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::key_eq() const
+{
+    return key_equal(Compare());
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+const value_type* BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::table() {
+    static const std::vector<value_type> values = [] {
+        std::vector<value_type> window_values(window);
+        for(std::size_t offset = 0; offset < window; ++offset) {
+            window_values[offset] = static_cast<value_type>(Min + static_cast<long long>(offset));
+        }
+        return window_values;
+    }();
+    return values.data();
+}
+
+template<long long Min, long long Max>
+template<class value_type, class Compare, class Allocator>
+std::size_t BitsetStorage<Min, Max>::storage<value_type, Compare, Allocator>::offsetOf(
+    value_type value
+) {
+    long long wide = static_cast<long long>(value);
+    if(wide < Min || wide > Max || (std::is_unsigned<value_type>::value && value > Max)) {
+        return window;
+    }
+    return static_cast<std::size_t>(
+        static_cast<unsigned long long>(wide) - static_cast<unsigned long long>(Min));
+}
+
+template<class value_type, class Compare, class Allocator>
+IntervalStorage::storage<value_type, Compare, Allocator>::storage(
+    const Compare& comp,
+    const Allocator& alloc
+): m_starts(alloc), m_ends(alloc), m_size(0), m_materialized(comp, alloc) {}
+
+template<class value_type, class Compare, class Allocator>
+template<class InputIt>
+IntervalStorage::storage<value_type, Compare, Allocator>::storage(
+    InputIt first, InputIt last,
+    const Compare& comp,
+    const Allocator& alloc
+): storage(comp, alloc)
+{
+    for(; first != last; ++first) {
+        const value_type value(*first);
+        insertInterval(value, value);
+    }
+}
+
+template<class value_type, class Compare, class Allocator>
+typename IntervalStorage::template storage<value_type, Compare, Allocator>::const_iterator
+    IntervalStorage::storage<value_type, Compare, Allocator>::begin() const
+{
+    return const_iterator(m_starts.data(), m_ends.data(), m_starts.size(), 0);
+}
+
+template<class value_type, class Compare, class Allocator>
+typename IntervalStorage::template storage<value_type, Compare, Allocator>::const_iterator
+    IntervalStorage::storage<value_type, Compare, Allocator>::end() const
+{
+    return const_iterator(m_starts.data(), m_ends.data(), m_starts.size(), m_starts.size());
+}
+
+template<class value_type, class Compare, class Allocator>
+typename IntervalStorage::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    IntervalStorage::storage<value_type, Compare, Allocator>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<class value_type, class Compare, class Allocator>
+typename IntervalStorage::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    IntervalStorage::storage<value_type, Compare, Allocator>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<class value_type, class Compare, class Allocator>
+std::size_t IntervalStorage::storage<value_type, Compare, Allocator>::size() const {
+    return m_size;
+}
+
+template<class value_type, class Compare, class Allocator>
+template<class K>
+bool IntervalStorage::storage<value_type, Compare, Allocator>::contains(
+    const K& key
+) const {
+    return intervalOf(static_cast<value_type>(key)) != m_starts.size();
+}
+
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* IntervalStorage::storage<value_type, Compare, Allocator>::find(
+    const K& key
+) const {
+    auto it = m_materialized.find(static_cast<value_type>(key));
+    return it == m_materialized.end() ? nullptr : &*it;
+}
+
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* IntervalStorage::storage<value_type, Compare, Allocator>::materialize(
+    const K& key
+) {
+    const value_type value = static_cast<value_type>(key);
+    if(intervalOf(value) == m_starts.size()) {
+        return nullptr;
+    }
+    return &*m_materialized.insert(value).first;
+}
+
+template<class value_type, class Compare, class Allocator>
+template<class... Args>
+std::pair<const value_type*, bool>
+    IntervalStorage::storage<value_type, Compare, Allocator>::emplace(
+    Args&&... args
+) {
+    const value_type value(std::forward<Args>(args)...);
+    bool inserted = insertInterval(value, value);
+    return std::make_pair(&*m_materialized.insert(value).first, inserted);
+}
+
+template<class value_type, class Compare, class Allocator>
+void IntervalStorage::storage<value_type, Compare, Allocator>::erase(
+    const value_type* value
+) {
+    const value_type copy = *value;
+    eraseInterval(copy, copy, [](const value_type*) {});
+}
+
+template<class value_type, class Compare, class Allocator>
+bool IntervalStorage::storage<value_type, Compare, Allocator>::insertInterval(
+    value_type lo, value_type hi
+) {
+    if(hi < lo) {
+        return false;
+    }
+
+    //Every interval from first to last overlaps [lo, hi] or touches it
+    std::size_t first = static_cast<std::size_t>(
+        std::lower_bound(m_ends.begin(), m_ends.end(), lo) - m_ends.begin());
+    if(first > 0 && m_ends[first - 1] + 1 == lo) {
+        --first;
+    }
+    std::size_t last = static_cast<std::size_t>(
+        std::upper_bound(m_starts.begin(), m_starts.end(), hi) - m_starts.begin());
+    if(last < m_starts.size() && hi + 1 == m_starts[last]) {
+        ++last;
+    }
+
+    if(first == last) {
+        m_starts.insert(m_starts.begin() + first, lo);
+        m_ends.insert(m_ends.begin() + first, hi);
+        m_size += width(lo, hi);
+        return true;
+    }
+
+    const value_type start = std::min(lo, m_starts[first]);
+    const value_type end = std::max(hi, m_ends[last - 1]);
+    std::size_t merged = 0;
+    for(std::size_t i = first; i < last; ++i) {
+        merged += width(m_starts[i], m_ends[i]);
+    }
+
+    m_starts[first] = start;
+    m_ends[first] = end;
+    m_starts.erase(m_starts.begin() + first + 1, m_starts.begin() + last);
+    m_ends.erase(m_ends.begin() + first + 1, m_ends.begin() + last);
+    m_size += width(start, end) - merged;
+    return width(start, end) != merged;
+}
+
+template<class value_type, class Compare, class Allocator>
+template<class OnErase>
+bool IntervalStorage::storage<value_type, Compare, Allocator>::eraseInterval(
+    value_type lo, value_type hi,
+    OnErase on_erase
+) {
+    if(hi < lo) {
+        return false;
+    }
+
+    //Every interval from first to last overlaps [lo, hi]
+    std::size_t first = static_cast<std::size_t>(
+        std::lower_bound(m_ends.begin(), m_ends.end(), lo) - m_ends.begin());
+    std::size_t last = static_cast<std::size_t>(
+        std::upper_bound(m_starts.begin(), m_starts.end(), hi) - m_starts.begin());
+    if(first >= last) {
+        return false;
+    }
+
+    auto materialized_first = m_materialized.lower_bound(lo);
+    auto materialized_last = m_materialized.upper_bound(hi);
+    for(auto it = materialized_first; it != materialized_last; ++it) {
+        on_erase(&*it);
+    }
+    m_materialized.erase(materialized_first, materialized_last);
+
+    //What is left of the first and last intervals outside of [lo, hi]
+    value_vector starts(m_starts.get_allocator());
+    value_vector ends(m_ends.get_allocator());
+    if(m_starts[first] < lo) {
+        starts.push_back(m_starts[first]);
+        ends.push_back(lo - 1);
+    }
+    if(hi < m_ends[last - 1]) {
+        starts.push_back(hi + 1);
+        ends.push_back(m_ends[last - 1]);
+    }
+
+    for(std::size_t i = first; i < last; ++i) {
+        m_size -= width(m_starts[i], m_ends[i]);
+    }
+    for(std::size_t i = 0; i < starts.size(); ++i) {
+        m_size += width(starts[i], ends[i]);
+    }
+
+    m_starts.erase(m_starts.begin() + first, m_starts.begin() + last);
+    m_ends.erase(m_ends.begin() + first, m_ends.begin() + last);
+    m_starts.insert(m_starts.begin() + first, starts.begin(), starts.end());
+    m_ends.insert(m_ends.begin() + first, ends.begin(), ends.end());
+    return true;
+}
+
+template<class value_type, class Compare, class Allocator>
+typename IntervalStorage::template storage<value_type, Compare, Allocator>::hasher
+    IntervalStorage::storage<value_type, Compare, Allocator>::hash_function() const
+{
+    return hasher();
+}
+
+template<class value_type, class Compare, class Allocator>
+typename IntervalStorage::template storage<value_type, Compare, Allocator>::key_equal
+    IntervalStorage::storage<value_type, Compare, Allocator>::key_eq() const
+{
+    return key_equal(Compare());
+}
+
+template<class value_type, class Compare, class Allocator>
+std::size_t IntervalStorage::storage<value_type, Compare, Allocator>::intervalOf(
+    value_type value
+) const {
+    std::size_t index = static_cast<std::size_t>(
+        std::upper_bound(m_starts.begin(), m_starts.end(), value) - m_starts.begin());
+    if(index == 0 || m_ends[index - 1] < value) {
+        return m_starts.size();
+    }
+    return index - 1;
+}
+
+template<class value_type, class Compare, class Allocator>
+std::size_t IntervalStorage::storage<value_type, Compare, Allocator>::width(
+    value_type lo, value_type hi
+) {
+    using unsigned_type = typename std::make_unsigned<value_type>::type;
+    return static_cast<std::size_t>(
+        static_cast<unsigned_type>(static_cast<unsigned_type>(hi) - static_cast<unsigned_type>(lo))) + 1;
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::storage(
+    const Compare& comp,
+    const Allocator& alloc
+): m_comp(comp), m_occupied(0), m_spill(comp, alloc)
+{
+    if(scan_all) {
+        for(std::size_t i = 0; i < N; ++i) {
+            ::new(static_cast<void*>(&m_slots[i].value)) value_type();
+        }
+    }
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+template<class InputIt>
+SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::storage(
+    InputIt first, InputIt last,
+    const Compare& comp,
+    const Allocator& alloc
+): storage(comp, alloc)
+{
+    for(; first != last; ++first) {
+        emplace(*first);
+    }
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::storage(
+    storage&& other
+): m_comp(other.m_comp), m_occupied(other.m_occupied), m_spill(std::move(other.m_spill))
+{
+    if(scan_all) {
+        for(std::size_t i = 0; i < N; ++i) {
+            ::new(static_cast<void*>(&m_slots[i].value)) value_type(other.m_slots[i].value);
+        }
+        return;
+    }
+    for(std::uint64_t bits = m_occupied; bits != 0; bits &= bits - 1) {
+        std::size_t i = drv_detail::count_trailing_zeros(bits);
+        ::new(static_cast<void*>(&m_slots[i].value)) value_type(std::move(other.m_slots[i].value));
+    }
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::~storage() {
+    std::uint64_t bits = scan_all ? (N == 64 ? ~UINT64_C(0) : (UINT64_C(1) << N) - 1) : m_occupied;
+    for(; bits != 0; bits &= bits - 1) {
+        m_slots[drv_detail::count_trailing_zeros(bits)].value.~value_type();
+    }
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+typename SmallStorage<N, Spill>::template storage<value_type, Compare, Allocator>::const_iterator
+    SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::begin() const
+{
+    const_iterator last = end();
+    return const_iterator(&m_slots[0].value, m_occupied, N,
+        last.next(0), m_spill.begin(), m_spill.begin());
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+typename SmallStorage<N, Spill>::template storage<value_type, Compare, Allocator>::const_iterator
+    SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::end() const
+{
+    return const_iterator(&m_slots[0].value, m_occupied, N,
+        N, m_spill.end(), m_spill.begin());
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+typename SmallStorage<N, Spill>::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+typename SmallStorage<N, Spill>::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+std::size_t SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::size() const {
+    return drv_detail::popcount(m_occupied) + m_spill.size();
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::find(
+    const K& key
+) const {
+    std::size_t index = slotOf(key);
+    if(index < N) {
+        return &m_slots[index].value;
+    }
+    return m_spill.size() == 0 ? nullptr : m_spill.find(key);
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+template<class... Args>
+std::pair<const value_type*, bool>
+    SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::emplace(
+    Args&&... args
+) {
+    value_type value(std::forward<Args>(args)...);
+    const value_type* existing = find(value);
+    if(existing != nullptr) {
+        return std::make_pair(existing, false);
+    }
+
+    std::uint64_t free = ~m_occupied & (N == 64 ? ~UINT64_C(0) : (UINT64_C(1) << N) - 1);
+    if(free == 0) {
+        return m_spill.emplace(std::move(value));
+    }
+
+    std::size_t index = drv_detail::count_trailing_zeros(free);
+    if(scan_all) {
+        m_slots[index].value = value;
+    } else {
+        ::new(static_cast<void*>(&m_slots[index].value)) value_type(std::move(value));
+    }
+    m_occupied |= UINT64_C(1) << index;
+    return std::make_pair(&m_slots[index].value, true);
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+void SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::erase(
+    const value_type* value
+) {
+    std::less<const value_type*> before;
+    if(before(value, &m_slots[0].value) || before(&m_slots[N - 1].value, value)) {
+        m_spill.erase(value);
+        return;
+    }
+
+    std::size_t index = static_cast<std::size_t>(reinterpret_cast<const slot*>(value) - m_slots);
+    if(!scan_all) {
+        m_slots[index].value.~value_type();
+    }
+    m_occupied &= ~(UINT64_C(1) << index);
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+typename SmallStorage<N, Spill>::template storage<value_type, Compare, Allocator>::hasher
+    SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::hash_function() const
+{
+    return m_spill.hash_function();
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+typename SmallStorage<N, Spill>::template storage<value_type, Compare, Allocator>::key_equal
+    SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::key_eq() const
+{
+    return m_spill.key_eq();
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+std::size_t SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::slotOf(
+    const K& key
+) const {
+    return slotOf(key, std::integral_constant<bool, scan_all>());
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+std::size_t SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::slotOf(
+    const value_type& key,
+    std::true_type
+) const {
+    std::uint64_t matches = 0;
+    for(std::size_t i = 0; i < N; ++i) {
+        matches |= static_cast<std::uint64_t>(m_slots[i].value == key) << i;
+    }
+    matches &= m_occupied;
+    return matches == 0 ? N : drv_detail::count_trailing_zeros(matches);
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+std::size_t SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::slotOf(
+    const K& key,
+    std::true_type
+) const {
+    return slotOf(static_cast<value_type>(key), std::true_type());
+}
+
+template<std::size_t N, class Spill>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+std::size_t SmallStorage<N, Spill>::storage<value_type, Compare, Allocator>::slotOf(
+    const K& key,
+    std::false_type
+) const {
+    for(std::uint64_t bits = m_occupied; bits != 0; bits &= bits - 1) {
+        std::size_t i = drv_detail::count_trailing_zeros(bits);
+        if(!m_comp(m_slots[i].value, key) && !m_comp(key, m_slots[i].value)) {
+            return i;
+        }
+    }
+    return N;
+}
+
+#if __cplusplus >= 201703L
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+InternedStorage<Inner>::storage<value_type, Compare, Allocator>::storage(
+    const Compare& comp,
+    const Allocator& alloc
+): m_views(comp, alloc), m_alloc(alloc), m_chunks(alloc), m_cursor(nullptr), m_remaining(0) {}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+template<class InputIt>
+InternedStorage<Inner>::storage<value_type, Compare, Allocator>::storage(
+    InputIt first, InputIt last,
+    const Compare& comp,
+    const Allocator& alloc
+): storage(comp, alloc)
+{
+    for(; first != last; ++first) {
+        emplace(*first);
+    }
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+InternedStorage<Inner>::storage<value_type, Compare, Allocator>::~storage() {
+    for(const chunk& c : m_chunks) {
+        std::allocator_traits<char_allocator>::deallocate(m_alloc, c.data, c.size);
+    }
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+typename InternedStorage<Inner>::template storage<value_type, Compare, Allocator>::const_iterator
+    InternedStorage<Inner>::storage<value_type, Compare, Allocator>::begin() const
+{
+    return m_views.begin();
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+typename InternedStorage<Inner>::template storage<value_type, Compare, Allocator>::const_iterator
+    InternedStorage<Inner>::storage<value_type, Compare, Allocator>::end() const
+{
+    return m_views.end();
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+typename InternedStorage<Inner>::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    InternedStorage<Inner>::storage<value_type, Compare, Allocator>::rbegin() const
+{
+    return m_views.rbegin();
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+typename InternedStorage<Inner>::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    InternedStorage<Inner>::storage<value_type, Compare, Allocator>::rend() const
+{
+    return m_views.rend();
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+std::size_t InternedStorage<Inner>::storage<value_type, Compare, Allocator>::size() const {
+    return m_views.size();
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* InternedStorage<Inner>::storage<value_type, Compare, Allocator>::find(
+    const K& key
+) const {
+    return m_views.find(key);
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+template<class... Args>
+std::pair<const value_type*, bool>
+    InternedStorage<Inner>::storage<value_type, Compare, Allocator>::emplace(
+    Args&&... args
+) {
+    const std::string_view value(std::forward<Args>(args)...);
+    //Only copy the characters of values that are not there yet
+    const value_type* existing = m_views.find(value);
+    if(existing != nullptr) {
+        return std::make_pair(existing, false);
+    }
+    return m_views.emplace(intern(value));
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+void InternedStorage<Inner>::storage<value_type, Compare, Allocator>::erase(
+    const value_type* value
+) {
+    m_views.erase(value);
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+typename InternedStorage<Inner>::template storage<value_type, Compare, Allocator>::hasher
+    InternedStorage<Inner>::storage<value_type, Compare, Allocator>::hash_function() const
+{
+    return m_views.hash_function();
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+typename InternedStorage<Inner>::template storage<value_type, Compare, Allocator>::key_equal
+    InternedStorage<Inner>::storage<value_type, Compare, Allocator>::key_eq() const
+{
+    return m_views.key_eq();
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+std::string_view InternedStorage<Inner>::storage<value_type, Compare, Allocator>::intern(
+    std::string_view value
+) {
+    if(value.empty()) {
+        return std::string_view();
+    }
+
+    if(value.size() > chunk_size / 4) {
+        char* copy = allocateChunk(value.size());
+        value.copy(copy, value.size());
+        return std::string_view(copy, value.size());
+    }
+
+    if(value.size() > m_remaining) {
+        m_cursor = allocateChunk(chunk_size);
+        m_remaining = chunk_size;
+    }
+    char* copy = m_cursor;
+    value.copy(copy, value.size());
+    m_cursor += value.size();
+    m_remaining -= value.size();
+    return std::string_view(copy, value.size());
+}
+
+template<class Inner>
+template<class value_type, class Compare, class Allocator>
+char* InternedStorage<Inner>::storage<value_type, Compare, Allocator>::allocateChunk(
+    std::size_t size
+) {
+    char* data = std::allocator_traits<char_allocator>::allocate(m_alloc, size);
+    try {
+        m_chunks.push_back(chunk{data, size});
+    } catch(...) {
+        std::allocator_traits<char_allocator>::deallocate(m_alloc, data, size);
+        throw;
+    }
+    return data;
+}
+#endif
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::storage(
+    const Compare&,
+    const Allocator&
+) {}
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+template<class InputIt>
+StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::storage(
+    InputIt first, InputIt last,
+    const Compare&,
+    const Allocator&
+) {
+    if(first != last) {
+        throw std::logic_error("The values of a StaticStorage are fixed at compile time.");
+    }
+}
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+typename StaticStorage<T, values...>::template storage<value_type, Compare, Allocator>::const_iterator
+    StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::begin() const
+{
+    return allowed_values;
+}
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+typename StaticStorage<T, values...>::template storage<value_type, Compare, Allocator>::const_iterator
+    StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::end() const
+{
+    return allowed_values + sizeof...(values);
+}
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+typename StaticStorage<T, values...>::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+typename StaticStorage<T, values...>::template storage<value_type, Compare, Allocator>::const_reverse_iterator
+    StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+std::size_t StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::size() const {
+    return sizeof...(values);
+}
+
+//The halving loop runs a number of times known at compile time, and the
+//step is a conditional move, so the search has no data dependent branch
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+template<class K>
+const value_type* StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::find(
+    const K& key
+) const {
+    const value_type* base = allowed_values;
+    for(std::size_t count = sizeof...(values); count > 1; count -= count / 2) {
+        base = key < base[count / 2] ? base : base + count / 2;
+    }
+    return *base == key ? base : nullptr;
+}
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+template<class... Args>
+std::pair<const value_type*, bool>
+    StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::emplace(
+    Args&&... args
+) {
+    const value_type value(std::forward<Args>(args)...);
+    return std::make_pair(find(value), false);
+}
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+void StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::erase(
+    const value_type*
+) {}
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+typename StaticStorage<T, values...>::template storage<value_type, Compare, Allocator>::hasher
+    StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::hash_function() const
+{
+    return hasher();
+}
+
+template<class T, T... values>
+template<class value_type, class Compare, class Allocator>
+typename StaticStorage<T, values...>::template storage<value_type, Compare, Allocator>::key_equal
+    StaticStorage<T, values...>::storage<value_type, Compare, Allocator>::key_eq() const
+{
+    return key_equal(Compare());
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+VariableDomain<value_type, Compare, Storage, Allocator>::VariableDomain(
+    std::initializer_list<value_type> ilist,
+    const Compare& comp,
+    const Allocator& alloc
+): m_mutex(), m_allowed_values(ilist.begin(), ilist.end(), comp, alloc),
+    m_frozen(drv_detail::is_fixed<storage_type>::value),
+    m_frozen_index(), m_sorted_snapshot(), m_sorted_snapshot_stale(true),
+    m_lookup_acceleration(LookupAcceleration::none),
+    m_eytzinger_index(comp), m_eytzinger_index_stale(true),
+    m_bloom_filter_enabled(false), m_bloom_filter_rate(0.01),
+    m_bloom_filter(m_allowed_values.hash_function()), m_bloom_filter_stale(true),
+    m_bloom_filter_stats(),
+    m_listeners(), m_next_listener_id(1), m_change_batches(0), m_pending_changes(),
+    m_snapshots(), m_snapshots_enabled(false), m_snapshot_stale(true),
+    m_allocator(alloc), m_managed_variables(0), m_unheld(nullptr), m_holders(alloc),
+    m_slots(alloc), m_free_slots(alloc), m_value_slots(alloc) {}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+VariableDomain<value_type, Compare, Storage, Allocator>::VariableDomain(
+    const Compare& comp,
+    const Allocator& alloc
+): m_mutex(), m_allowed_values(comp, alloc),
+    m_frozen(drv_detail::is_fixed<storage_type>::value),
+    m_frozen_index(), m_sorted_snapshot(), m_sorted_snapshot_stale(true),
+    m_lookup_acceleration(LookupAcceleration::none),
+    m_eytzinger_index(comp), m_eytzinger_index_stale(true),
+    m_bloom_filter_enabled(false), m_bloom_filter_rate(0.01),
+    m_bloom_filter(m_allowed_values.hash_function()), m_bloom_filter_stale(true),
+    m_bloom_filter_stats(),
+    m_listeners(), m_next_listener_id(1), m_change_batches(0), m_pending_changes(),
+    m_snapshots(), m_snapshots_enabled(false), m_snapshot_stale(true),
+    m_allocator(alloc), m_managed_variables(0), m_unheld(nullptr), m_holders(alloc),
+    m_slots(alloc), m_free_slots(alloc), m_value_slots(alloc) {}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+VariableDomain<value_type, Compare, Storage, Allocator>::VariableDomain(
+    const Allocator& alloc
+): VariableDomain(Compare(), alloc) {}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class InputIt>
+VariableDomain<value_type, Compare, Storage, Allocator>::VariableDomain(
+    InputIt first, InputIt last,
+    const Compare& comp,
+    const Allocator& alloc
+): m_mutex(), m_allowed_values(first, last, comp, alloc),
+    m_frozen(drv_detail::is_fixed<storage_type>::value),
+    m_frozen_index(), m_sorted_snapshot(), m_sorted_snapshot_stale(true),
+    m_lookup_acceleration(LookupAcceleration::none),
+    m_eytzinger_index(comp), m_eytzinger_index_stale(true),
+    m_bloom_filter_enabled(false), m_bloom_filter_rate(0.01),
+    m_bloom_filter(m_allowed_values.hash_function()), m_bloom_filter_stale(true),
+    m_bloom_filter_stats(),
+    m_listeners(), m_next_listener_id(1), m_change_batches(0), m_pending_changes(),
+    m_snapshots(), m_snapshots_enabled(false), m_snapshot_stale(true),
+    m_allocator(alloc), m_managed_variables(0), m_unheld(nullptr), m_holders(alloc),
+    m_slots(alloc), m_free_slots(alloc), m_value_slots(alloc) {}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+VariableDomain<value_type, Compare, Storage, Allocator>::~VariableDomain() noexcept(false) {
+    if(m_managed_variables != 0) {
+        throw std::logic_error(
+            "Cannot destroy a VariableDomain if DomainRestrictedVariable(s) depend on it.");
+    }
+    holder_list_allocator alloc(m_allocator);
+    for(auto& holders : m_holders) {
+        std::allocator_traits<holder_list_allocator>::destroy(alloc, holders.second);
+        std::allocator_traits<holder_list_allocator>::deallocate(alloc, holders.second, 1);
+    }
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+typename VariableDomain<value_type, Compare, Storage, Allocator>::const_iterator
+    VariableDomain<value_type, Compare, Storage, Allocator>::begin() const
+{
+    return m_allowed_values.begin();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+typename VariableDomain<value_type, Compare, Storage, Allocator>::const_iterator
+    VariableDomain<value_type, Compare, Storage, Allocator>::cbegin() const
+{
+    return m_allowed_values.begin();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+typename VariableDomain<value_type, Compare, Storage, Allocator>::const_iterator
+    VariableDomain<value_type, Compare, Storage, Allocator>::end() const
+{
+    return m_allowed_values.end();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+typename VariableDomain<value_type, Compare, Storage, Allocator>::const_iterator
+    VariableDomain<value_type, Compare, Storage, Allocator>::cend() const
+{
+    return m_allowed_values.end();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+typename VariableDomain<value_type, Compare, Storage, Allocator>::const_reverse_iterator
+    VariableDomain<value_type, Compare, Storage, Allocator>::rbegin() const
+{
+    return m_allowed_values.rbegin();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+typename VariableDomain<value_type, Compare, Storage, Allocator>::const_reverse_iterator
+    VariableDomain<value_type, Compare, Storage, Allocator>::crbegin() const
+{
+    return m_allowed_values.rbegin();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+typename VariableDomain<value_type, Compare, Storage, Allocator>::const_reverse_iterator
+    VariableDomain<value_type, Compare, Storage, Allocator>::rend() const
+{
+    return m_allowed_values.rend();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+typename VariableDomain<value_type, Compare, Storage, Allocator>::const_reverse_iterator
+    VariableDomain<value_type, Compare, Storage, Allocator>::crend() const
+{
+    return m_allowed_values.rend();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::isAllowedValue(
+    const value_type& value
+) const {
+    read_guard guard(m_mutex, [this] { return lookupStale(); });
+    return contains(value, drv_detail::is_materialized<storage_type>());
+}
+
+#if __cplusplus >= 201402L
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class K>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::isAllowedValue(
+    K&& x
+) const {
+    read_guard guard(m_mutex, [this] { return lookupStale(); });
+    return contains(x, drv_detail::is_materialized<storage_type>());
+}
+#endif
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::isAllowedValues(
+    const value_type* values, std::size_t count,
+    std::uint64_t* bitmask_out
+) const {
+    read_guard guard(m_mutex, [this] {
+        return sorted_batches ? m_sorted_snapshot_stale : lookupStale();
+    });
+    isAllowedValues(values, count, bitmask_out, std::integral_constant<bool, sorted_batches>());
+}
+
+#if __cplusplus >= 202002L
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::isAllowedValues(
+    std::span<const value_type> values,
+    std::uint64_t* bitmask_out
+) const {
+    isAllowedValues(values.data(), values.size(), bitmask_out);
+}
+#endif
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::addAllowedValue(
+    const value_type& value
+) {
+    exclusive_guard guard(m_mutex);
+    return add(value);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::addAllowedValue(
+    value_type&& value
+) {
+    exclusive_guard guard(m_mutex);
+    return add(std::move(value));
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class InputIt>
+void VariableDomain<value_type, Compare, Storage, Allocator>::addAllowedValuesRange(
+    InputIt first, InputIt last
+) {
+    exclusive_guard guard(m_mutex);
+    throwIfFrozen();
+    for(; first != last; ++first) {
+        auto pair = m_allowed_values.emplace(*first);
+        if(pair.second) {
+            valueAdded(*pair.first);
+        }
+    }
+    valuesChanged();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::addAllowedValues(
+    std::initializer_list<value_type> ilist
+) {
+    addAllowedValuesRange(ilist.begin(), ilist.end());
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class... Args>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::emplaceAllowedValue(
+    Args&&... args
+) {
+    exclusive_guard guard(m_mutex);
+    if(m_frozen) {
+        return false;
+    }
+
+    auto pair = m_allowed_values.emplace(std::forward<Args>(args)...);
+    if(!pair.second) {
+        return false;
+    }
+    valueAdded(*pair.first);
+    valuesChanged();
+    return true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::removeAllowedValue(
+    const value_type& value
+) {
+    exclusive_guard guard(m_mutex);
+    return remove(value);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class InputIt>
+void VariableDomain<value_type, Compare, Storage, Allocator>::removeAllowedValuesRange(
+    InputIt first, InputIt last
+) {
+    exclusive_guard guard(m_mutex);
+    throwIfFrozen();
+
+    //Straight from the storage: the Bloom filter and the Eytzinger index
+    //would otherwise be rebuilt after every removal
+    std::vector<const value_type*> to_delete;
+    for(; first != last; ++first) {
+        const value_type* ptr = findStored(*first);
+        if(ptr != nullptr) {
+            to_delete.push_back(ptr);
+        }
+    }
+    if(to_delete.empty()) {
+        return;
+    }
+    std::sort(to_delete.begin(), to_delete.end(), std::less<const value_type*>());
+    to_delete.erase(std::unique(to_delete.begin(), to_delete.end()), to_delete.end());
+
+    for(const value_type* ptr : to_delete) {
+        valueRemoved(*ptr);
+        deletionNotice(ptr);
+        m_allowed_values.erase(ptr);
+    }
+    valuesChanged();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::removeAllowedValues(
+    std::initializer_list<value_type> ilist
+) {
+    removeAllowedValuesRange(ilist.begin(), ilist.end());
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::replaceAllowedValue(
+    const value_type& to_replace,
+    const value_type& replacement
+) {
+    exclusive_guard guard(m_mutex);
+    return replace(to_replace, replacement);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::replaceAllowedValue(
+    const value_type& to_replace,
+    value_type&& replacement
+) {
+    exclusive_guard guard(m_mutex);
+    return replace(to_replace, std::move(replacement));
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class InputIt>
+void VariableDomain<value_type, Compare, Storage, Allocator>::replaceAllowedValuesRange(
+    InputIt first, InputIt last
+) {
+    exclusive_guard guard(m_mutex);
+    throwIfFrozen();
+
+    bool changed = false;
+    for(; first != last; ++first) {
+        //Straight from the storage, for the same reason as in removeAllowedValuesRange
+        const value_type* ptr = findStored(first->first);
+        if(ptr == nullptr) {
+            continue;
+        }
+        auto pair = m_allowed_values.emplace(first->second);
+        if(pair.first == nullptr || pair.first == ptr) {
+            continue;
+        }
+        valueReplaced(*ptr, *pair.first);
+        replacementNotice(ptr, pair.first);
+        m_allowed_values.erase(ptr);
+        changed = true;
+    }
+    if(changed) {
+        valuesChanged();
+    }
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::replaceAllowedValues(
+    std::initializer_list<std::pair<value_type, value_type>> remap
+) {
+    replaceAllowedValuesRange(remap.begin(), remap.end());
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::addAllowedInterval(
+    const value_type& lo,
+    const value_type& hi
+) {
+    exclusive_guard guard(m_mutex);
+    if(m_frozen || !m_allowed_values.insertInterval(lo, hi)) {
+        return false;
+    }
+    if(!m_listeners.empty()) {
+        m_pending_changes.added_intervals.push_back(std::make_pair(lo, hi));
+    }
+    valuesChanged();
+    return true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::removeAllowedInterval(
+    const value_type& lo,
+    const value_type& hi
+) {
+    exclusive_guard guard(m_mutex);
+    if(m_frozen) {
+        return false;
+    }
+
+    //Only values that have an address can be held by a variable
+    bool removed = m_allowed_values.eraseInterval(lo, hi, [this](const value_type* to_delete) {
+        deletionNotice(to_delete);
+    });
+    if(!removed) {
+        return false;
+    }
+    if(!m_listeners.empty()) {
+        m_pending_changes.removed_intervals.push_back(std::make_pair(lo, hi));
+    }
+    valuesChanged();
+    return true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+std::vector<value_type> VariableDomain<value_type, Compare, Storage, Allocator>::allowedValues() const {
+    shared_guard guard(m_mutex);
+    return std::vector<value_type>(begin(), end());
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+typename VariableDomain<value_type, Compare, Storage, Allocator>::allocator_type
+    VariableDomain<value_type, Compare, Storage, Allocator>::get_allocator() const
+{
+    return m_allocator;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+std::size_t VariableDomain<value_type, Compare, Storage, Allocator>::useCount(
+    const value_type& value
+) const {
+    read_guard guard(m_mutex, [this] { return lookupStale(); });
+    const value_type* ptr = locate(value);
+    return ptr == nullptr ? 0 : useCountOf(ptr);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+std::vector<value_type> VariableDomain<value_type, Compare, Storage, Allocator>::unusedValues() const {
+    shared_guard guard(m_mutex);
+    return unusedValues(drv_detail::is_materialized<storage_type>());
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+std::vector<std::pair<value_type, std::size_t>>
+    VariableDomain<value_type, Compare, Storage, Allocator>::useCounts() const
+{
+    shared_guard guard(m_mutex);
+    std::vector<std::pair<value_type, std::size_t>> counts;
+    for(auto& holders : m_holders) {
+        if(holders.second->count != 0) {
+            counts.push_back(std::make_pair(*holders.first, holders.second->count));
+        }
+    }
+    return counts;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::enableSnapshots() {
+    exclusive_guard guard(m_mutex);
+    if(m_snapshots_enabled) {
+        return;
+    }
+    if(!m_snapshots) {
+        m_snapshots.reset(new snapshot_reclaimer());
+    }
+    m_snapshots_enabled = true;
+    m_snapshot_stale = true;
+    publishSnapshot();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::disableSnapshots() {
+    exclusive_guard guard(m_mutex);
+    if(!m_snapshots_enabled) {
+        return;
+    }
+    m_snapshots_enabled = false;
+    m_snapshots->publish(nullptr);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainSnapshot<value_type, Compare, Storage, Allocator>
+    VariableDomain<value_type, Compare, Storage, Allocator>::snapshot() const
+{
+    if(!m_snapshots) {
+        throw std::logic_error("Snapshots of this VariableDomain are not enabled.");
+    }
+    DomainSnapshot<value_type, Compare, Storage, Allocator> taken(*m_snapshots);
+    if(taken.m_values == nullptr) {
+        throw std::logic_error("Snapshots of this VariableDomain are not enabled.");
+    }
+    return taken;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+std::size_t VariableDomain<value_type, Compare, Storage, Allocator>::addListener(
+    change_listener listener
+) {
+    exclusive_guard guard(m_mutex);
+    m_listeners.push_back(std::make_pair(m_next_listener_id, std::move(listener)));
+    return m_next_listener_id++;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::removeListener(
+    std::size_t id
+) {
+    exclusive_guard guard(m_mutex);
+    for(auto it = m_listeners.begin(); it != m_listeners.end(); ++it) {
+        if(it->first == id) {
+            m_listeners.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::beginChangeBatch() {
+    exclusive_guard guard(m_mutex);
+    ++m_change_batches;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::endChangeBatch() {
+    exclusive_guard guard(m_mutex);
+    if(m_change_batches == 0) {
+        throw std::logic_error("endChangeBatch() called without a matching beginChangeBatch().");
+    }
+    --m_change_batches;
+    publishSnapshot();
+    publishChanges();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::removeAllowedValueIfUnused(
+    const value_type& value
+) {
+    exclusive_guard guard(m_mutex);
+    if(m_frozen) {
+        return false;
+    }
+
+    const value_type* ptr = locateAddress(value);
+    if(ptr == nullptr || useCountOf(ptr) != 0) {
+        return false;
+    }
+
+    valueRemoved(*ptr);
+    //Lazy variables may still hold it
+    deletionNotice(ptr);
+    m_allowed_values.erase(ptr);
+    valuesChanged();
+    return true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::freeze() {
+    static_assert(
+        !std::is_same<typename storage_type::hasher, drv_detail::unhashable>::value,
+        "Freezing a VariableDomain needs a hash that agrees with Compare: std::hash under "
+        "std::less or std::greater, otherwise a CompareHash specialization.");
+
+    exclusive_guard guard(m_mutex);
+    if(m_frozen) {
+        return;
+    }
+
+    buildFrozenIndex(std::integral_constant<bool,
+        !drv_detail::is_materialized<storage_type>::value>());
+    m_frozen = true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::thaw() {
+    exclusive_guard guard(m_mutex);
+    if(drv_detail::is_fixed<storage_type>::value) {
+        return;
+    }
+
+    m_frozen_index.reset();
+    m_frozen = false;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::isFrozen() const {
+    shared_guard guard(m_mutex);
+    return m_frozen;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::setLookupAcceleration(
+    LookupAcceleration acceleration
+) {
+    exclusive_guard guard(m_mutex);
+    m_lookup_acceleration = acceleration;
+    m_eytzinger_index.clear();
+    m_eytzinger_index_stale = true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+LookupAcceleration VariableDomain<value_type, Compare, Storage, Allocator>::lookupAcceleration() const {
+    shared_guard guard(m_mutex);
+    return m_lookup_acceleration;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::enableBloomFilter(
+    double false_positive_rate
+) {
+    static_assert(
+        !std::is_same<typename storage_type::hasher, drv_detail::unhashable>::value,
+        "A Bloom filter needs a hash that agrees with Compare: std::hash under "
+        "std::less or std::greater, otherwise a CompareHash specialization.");
+    static_assert(!drv_detail::is_materialized<storage_type>::value,
+        "Materialized storages cannot be given a Bloom filter.");
+
+    if(!(false_positive_rate > 0.0 && false_positive_rate < 1.0)) {
+        throw std::invalid_argument("A Bloom filter false positive rate must lie in (0, 1).");
+    }
+
+    exclusive_guard guard(m_mutex);
+    m_bloom_filter_enabled = true;
+    m_bloom_filter_rate = false_positive_rate;
+    m_bloom_filter_stale = true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::disableBloomFilter() {
+    exclusive_guard guard(m_mutex);
+    m_bloom_filter_enabled = false;
+    m_bloom_filter.clear();
+    m_bloom_filter_stale = true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::isBloomFilterEnabled() const {
+    shared_guard guard(m_mutex);
+    return m_bloom_filter_enabled;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+BloomFilterStats VariableDomain<value_type, Compare, Storage, Allocator>::bloomFilterStats() const {
+    shared_guard guard(m_mutex);
+    return m_bloom_filter_stats;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::resetBloomFilterStats() {
+    exclusive_guard guard(m_mutex);
+    m_bloom_filter_stats = BloomFilterStats();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::lookupStale() const {
+    return (m_bloom_filter_enabled && m_bloom_filter_stale)
+        || (m_lookup_acceleration == LookupAcceleration::eytzinger
+            && !m_frozen_index && m_eytzinger_index_stale);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class K>
+const value_type* VariableDomain<value_type, Compare, Storage, Allocator>::locate(
+    const K& key
+) const {
+    if(!m_bloom_filter_enabled) {
+        return lookup(key);
+    }
+
+    //Concurrent lookups only share the lock, so they leave the counters be
+    if(!bloomFilter().mayContain(key)) {
+        if(!concurrent) {
+            ++m_bloom_filter_stats.rejected;
+        }
+        return nullptr;
+    }
+    const value_type* found = lookup(key);
+    if(!concurrent) {
+        ++(found != nullptr ? m_bloom_filter_stats.hits : m_bloom_filter_stats.misses);
+    }
+    return found;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class K>
+const value_type* VariableDomain<value_type, Compare, Storage, Allocator>::locateAddress(
+    const K& key
+) {
+    return drv_detail::is_materialized<storage_type>::value ? findStored(key) : locate(key);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class K>
+const value_type* VariableDomain<value_type, Compare, Storage, Allocator>::findStored(
+    const K& key
+) {
+    return findStored(key, drv_detail::is_materialized<storage_type>());
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class K>
+const value_type* VariableDomain<value_type, Compare, Storage, Allocator>::findStored(
+    const K& key,
+    std::true_type
+) {
+    return m_allowed_values.materialize(key);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class K>
+const value_type* VariableDomain<value_type, Compare, Storage, Allocator>::findStored(
+    const K& key,
+    std::false_type
+) {
+    return m_allowed_values.find(key);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class K>
+const value_type* VariableDomain<value_type, Compare, Storage, Allocator>::lookup(
+    const K& key
+) const {
+    if(m_frozen_index) {
+        return m_frozen_index->find(key);
+    }
+    if(m_lookup_acceleration == LookupAcceleration::eytzinger) {
+        return locateAccelerated(key, std::integral_constant<bool,
+            !drv_detail::is_materialized<storage_type>::value>());
+    }
+    return m_allowed_values.find(key);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class K>
+const value_type* VariableDomain<value_type, Compare, Storage, Allocator>::locateAccelerated(
+    const K& key,
+    std::true_type
+) const {
+    if(m_eytzinger_index_stale) {
+        m_eytzinger_index.assign(m_allowed_values.begin(), m_allowed_values.end());
+        m_eytzinger_index_stale = false;
+    }
+    return m_eytzinger_index.find(key);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class K>
+const value_type* VariableDomain<value_type, Compare, Storage, Allocator>::locateAccelerated(
+    const K& key,
+    std::false_type
+) const {
+    return m_allowed_values.find(key);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class K>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::contains(
+    const K& key,
+    std::true_type
+) const {
+    return m_allowed_values.contains(key);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class K>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::contains(
+    const K& key,
+    std::false_type
+) const {
+    return locate(key) != nullptr;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class T>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::add(
+    T&& value
+) {
+    if(m_frozen) {
+        return false;
+    }
+
+    auto pair = m_allowed_values.emplace(std::forward<T>(value));
+    if(!pair.second) {
+        return false;
+    }
+    valueAdded(*pair.first);
+    valuesChanged();
+    return true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::remove(
+    const value_type& value
+) {
+    if(m_frozen) {
+        return false;
+    }
+
+    const value_type* ptr = locateAddress(value);
+    if(ptr == nullptr) {
+        return false;
+    }
+
+    valueRemoved(*ptr);
+    deletionNotice(ptr);
+    m_allowed_values.erase(ptr);
+    valuesChanged();
+    return true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+template<class T>
+bool VariableDomain<value_type, Compare, Storage, Allocator>::replace(
+    const value_type& to_replace,
+    T&& replacement
+) {
+    if(m_frozen) {
+        return false;
+    }
+
+    const value_type* ptr = locateAddress(to_replace);
+    if(ptr == nullptr) {
+        return false;
+    }
+
+    auto pair = m_allowed_values.emplace(std::forward<T>(replacement));
+    if(pair.first == nullptr) {
+        return false;
+    }
+    //Replacing a value with an equivalent one leaves the domain untouched
+    if(pair.first == ptr) {
+        return true;
+    }
+
+    valueReplaced(*ptr, *pair.first);
+    replacementNotice(ptr, pair.first);
+
+    m_allowed_values.erase(ptr);
+    valuesChanged();
+    return true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::throwIfFrozen() const {
+    if(m_frozen) {
+        throw std::logic_error("Cannot modify a frozen VariableDomain.");
+    }
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::buildFrozenIndex(
+    std::true_type
+) {
+    std::unique_ptr<const frozen_index_type> index(new frozen_index_type(
+        m_allowed_values.begin(), m_allowed_values.end(),
+        m_allowed_values.hash_function(), m_allowed_values.key_eq()));
+    if(index->valid()) {
+        m_frozen_index = std::move(index);
+    }
+}
+
+//Materialized storages have no addresses to index; they keep answering
+//lookups themselves
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::buildFrozenIndex(
+    std::false_type
+) {}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::valuesChanged() {
+    m_sorted_snapshot_stale = true;
+    m_eytzinger_index_stale = true;
+    m_snapshot_stale = true;
+    publishSnapshot();
+    publishChanges();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::valueAdded(
+    const value_type& value
+) {
+    if(!m_listeners.empty()) {
+        m_pending_changes.added.push_back(value);
+    }
+    if(!m_bloom_filter_enabled || m_bloom_filter_stale) {
+        return;
+    }
+    if(m_bloom_filter.size() >= m_bloom_filter.capacity()) {
+        m_bloom_filter_stale = true;
+        return;
+    }
+    m_bloom_filter.insert(value);
+}
+
+//The filter still lets every remaining value through, only less precisely
+//than after a rebuild
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::valueRemoved(
+    const value_type& value
+) {
+    if(!m_listeners.empty()) {
+        m_pending_changes.removed.push_back(value);
+    }
+    m_bloom_filter_stale = true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::valueReplaced(
+    const value_type& to_replace,
+    const value_type& replacement
+) {
+    if(!m_listeners.empty()) {
+        m_pending_changes.replaced.push_back(std::make_pair(to_replace, replacement));
+    }
+    m_bloom_filter_stale = true;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::publishChanges() {
+    if(m_change_batches != 0 || m_pending_changes.empty()) {
+        return;
+    }
+    DomainChanges<value_type> changes;
+    std::swap(changes, m_pending_changes);
+    //Listeners may add or remove listeners, or change the domain again
+    std::vector<std::pair<std::size_t, change_listener>> listeners(m_listeners);
+    for(auto& listener : listeners) {
+        listener.second(changes);
+    }
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::publishSnapshot() {
+    if(!m_snapshots_enabled || !m_snapshot_stale || m_change_batches != 0) {
+        return;
+    }
+    std::unique_ptr<std::vector<value_type>> values(
+        new std::vector<value_type>(m_allowed_values.begin(), m_allowed_values.end()));
+    std::sort(values->begin(), values->end(), Compare());
+    m_snapshots->publish(values.get());
+    values.release();
+    m_snapshot_stale = false;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+const typename VariableDomain<value_type, Compare, Storage, Allocator>::bloom_filter_type&
+    VariableDomain<value_type, Compare, Storage, Allocator>::bloomFilter() const
+{
+    if(m_bloom_filter_stale) {
+        m_bloom_filter.reset(
+            std::max<std::size_t>(2 * m_allowed_values.size(), 64),
+            m_bloom_filter_rate);
+        for(const value_type& value : m_allowed_values) {
+            m_bloom_filter.insert(value);
+        }
+        m_bloom_filter_stale = false;
+    }
+    return m_bloom_filter;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+const std::vector<value_type>&
+    VariableDomain<value_type, Compare, Storage, Allocator>::sortedSnapshot() const
+{
+    if(m_sorted_snapshot_stale) {
+        m_sorted_snapshot.assign(m_allowed_values.begin(), m_allowed_values.end());
+        std::sort(m_sorted_snapshot.begin(), m_sorted_snapshot.end());
+        m_sorted_snapshot_stale = false;
+    }
+    return m_sorted_snapshot;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::isAllowedValues(
+    const value_type* values, std::size_t count,
+    std::uint64_t* bitmask_out,
+    std::true_type
+) const {
+    const std::vector<value_type>& sorted = sortedSnapshot();
+    drv_detail::batch_contains(sorted.data(), sorted.size(), values, count, bitmask_out);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::isAllowedValues(
+    const value_type* values, std::size_t count,
+    std::uint64_t* bitmask_out,
+    std::false_type
+) const {
+    std::fill(bitmask_out, bitmask_out + (count + 63) / 64, 0);
+    for(std::size_t i = 0; i < count; ++i) {
+        bitmask_out[i / 64] |= static_cast<std::uint64_t>(
+            contains(values[i], drv_detail::is_materialized<storage_type>())) << (i % 64);
+    }
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::subscribeVariable(
+    variable_type* const ptr,
+    const value_type* value
+) {
+    holder_list& holders = holdersOf(value);
+    ptr->link_before(&holders);
+    ptr->m_list = &holders;
+    ++holders.count;
+    ++m_managed_variables;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::subscribeCopy(
+    variable_type* const ptr,
+    const variable_type* other
+) {
+    ptr->link_before(other->next);
+    ptr->m_list = other->m_list;
+    ++ptr->m_list->count;
+    ++m_managed_variables;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::unsubscribeVariable(
+    variable_type* const ptr
+) {
+    ptr->unlink();
+    --ptr->m_list->count;
+    --m_managed_variables;
+    releaseIfOrphaned(ptr->m_list);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::reassignVariable(
+    variable_type* const ptr,
+    const value_type* value
+) {
+    if(ptr->m_list->value == value) {
+        return;
+    }
+    holder_list& holders = holdersOf(value);
+    holder_list* previous = ptr->m_list;
+    ptr->unlink();
+    --previous->count;
+    ptr->link_before(&holders);
+    ptr->m_list = &holders;
+    ++holders.count;
+    releaseIfOrphaned(previous);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+typename VariableDomain<value_type, Compare, Storage, Allocator>::holder_list&
+    VariableDomain<value_type, Compare, Storage, Allocator>::holdersOf(
+    const value_type* value
+) {
+    if(value == nullptr) {
+        return m_unheld;
+    }
+    auto it = m_holders.lower_bound(value);
+    if(it != m_holders.end() && it->first == value) {
+        return *it->second;
+    }
+
+    holder_list_allocator alloc(m_allocator);
+    holder_list* holders = std::allocator_traits<holder_list_allocator>::allocate(alloc, 1);
+    std::allocator_traits<holder_list_allocator>::construct(alloc, holders, value);
+    try {
+        m_holders.insert(it, std::make_pair(value, holders));
+    } catch(...) {
+        std::allocator_traits<holder_list_allocator>::destroy(alloc, holders);
+        std::allocator_traits<holder_list_allocator>::deallocate(alloc, holders, 1);
+        throw;
+    }
+    return *holders;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::releaseIfOrphaned(
+    holder_list* list
+) {
+    if(list->value != nullptr || list == &m_unheld || list->count != 0) {
+        return;
+    }
+    holder_list_allocator alloc(m_allocator);
+    std::allocator_traits<holder_list_allocator>::destroy(alloc, list);
+    std::allocator_traits<holder_list_allocator>::deallocate(alloc, list, 1);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+std::size_t VariableDomain<value_type, Compare, Storage, Allocator>::useCountOf(
+    const value_type* value
+) const {
+    auto holders = m_holders.find(value);
+    return holders == m_holders.end() ? 0 : holders->second->count;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+std::vector<value_type> VariableDomain<value_type, Compare, Storage, Allocator>::unusedValues(
+    std::true_type
+) const {
+    //Iteration yields copies, so held values are matched by value rather
+    //than by address
+    std::vector<value_type> used;
+    for(auto& holders : m_holders) {
+        if(holders.second->count != 0) {
+            used.push_back(*holders.first);
+        }
+    }
+    Compare comp;
+    std::sort(used.begin(), used.end(), comp);
+
+    std::vector<value_type> unused;
+    for(const value_type& value : m_allowed_values) {
+        if(!std::binary_search(used.begin(), used.end(), value, comp)) {
+            unused.push_back(value);
+        }
+    }
+    return unused;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+std::vector<value_type> VariableDomain<value_type, Compare, Storage, Allocator>::unusedValues(
+    std::false_type
+) const {
+    std::vector<value_type> unused;
+    for(const value_type& value : m_allowed_values) {
+        if(useCountOf(&value) == 0) {
+            unused.push_back(value);
+        }
+    }
+    return unused;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::deletionNotice(
+    const value_type* to_delete
+) {
+    replacementNotice(to_delete, nullptr);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void VariableDomain<value_type, Compare, Storage, Allocator>::replacementNotice(
+    const value_type* to_replace,
+    const value_type* replacement
+) {
+    auto holders = m_holders.find(to_replace);
+    //Before anything changes, as it may allocate: the replacement's own
+    //holders if it has some, otherwise the list of to_replace is re-keyed
+    auto target = m_holders.end();
+    if(holders != m_holders.end() && replacement != nullptr) {
+        target = m_holders.insert(std::make_pair(replacement, holders->second)).first;
+    }
+
+    auto slot = m_value_slots.lower_bound(slot_key(to_replace, 0));
+    while(slot != m_value_slots.end() && slot->first == to_replace) {
+        std::size_t index = slot->second;
+        if(replacement == nullptr) {
+            m_free_slots.push_back(index);
+            //DomainValueRef keeps the low half of the generation, and zero
+            //there stands for a null reference. The generation changes
+            //first, for the readers of resolveSlot
+            if(static_cast<std::uint32_t>(++m_slots[index].generation) == 0) {
+                ++m_slots[index].generation;
+            }
+            m_slots[index].value = nullptr;
+        } else {
+            m_value_slots.insert(slot_key(replacement, index));
+            m_slots[index].value = replacement;
+        }
+        slot = m_value_slots.erase(slot);
+    }
+
+    if(holders == m_holders.end()) {
+        return;
+    }
+    holder_list* list = holders->second;
+    m_holders.erase(holders);
+    if(replacement == nullptr) {
+        list->value = nullptr;
+        releaseIfOrphaned(list);
+        return;
+    }
+    if(target->second == list) {
+        list->value = replacement;
+        return;
+    }
+
+    //Both values were held: the smaller list joins the larger one, so a
+    //variable changes lists O(log n) times at most over any sequence of merges
+    holder_list* other = target->second;
+    if(list->count > other->count) {
+        std::swap(list, other);
+    }
+    for(drv_detail::list_hook* node = list->next; node != list; node = node->next) {
+        static_cast<variable_type*>(node)->m_list = other;
+    }
+    other->splice(*list);
+    other->value = replacement;
+    target->second = other;
+    list->value = nullptr;
+    releaseIfOrphaned(list);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+std::size_t VariableDomain<value_type, Compare, Storage, Allocator>::slotOf(
+    const value_type* value
+) {
+    auto it = m_value_slots.lower_bound(slot_key(value, 0));
+    if(it != m_value_slots.end() && it->first == value) {
+        return it->second;
+    }
+
+    bool reused = !m_free_slots.empty();
+    std::size_t index = reused ? m_free_slots.back() : m_slots.size();
+    if(!reused) {
+        m_slots.push_back();
+    }
+    try {
+        m_value_slots.insert(it, slot_key(value, index));
+    } catch(...) {
+        if(!reused) {
+            m_slots.pop_back();
+        }
+        throw;
+    }
+    if(reused) {
+        m_free_slots.pop_back();
+    }
+    m_slots[index].value = value;
+    return index;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+std::size_t VariableDomain<value_type, Compare, Storage, Allocator>::findSlot(
+    const value_type* value
+) const {
+    auto it = m_value_slots.lower_bound(slot_key(value, 0));
+    return it != m_value_slots.end() && it->first == value ? it->second : SIZE_MAX;
+}
+
+//The slot may be freed, and even reused, while it is read; a value left the
+//domain only after the generation changed, so seeing the same generation on
+//both sides of reading the value means the value was still there
+template<class value_type, class Compare, class Storage, class Allocator>
+const value_type* VariableDomain<value_type, Compare, Storage, Allocator>::resolveSlot(
+    std::size_t slot,
+    std::uint64_t generation
+) const {
+    const typename drv_detail::slot_table<value_type, Allocator>::slot& entry = m_slots[slot];
+    if(entry.generation.load() != generation) {
+        return nullptr;
+    }
+    const value_type* value = entry.value.load();
+    return entry.generation.load() == generation ? value : nullptr;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainValueRef<value_type, Compare, Storage, Allocator>
+    VariableDomain<value_type, Compare, Storage, Allocator>::refTo(
+    std::size_t slot
+) const {
+    if(slot > UINT32_MAX) {
+        throw std::length_error("A VariableDomain hands out at most 2^32 DomainValueRef slots.");
+    }
+    return DomainValueRef<value_type, Compare, Storage, Allocator>(
+        static_cast<std::uint32_t>(slot),
+        static_cast<std::uint32_t>(m_slots[slot].generation.load()));
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::DomainRestrictedVariable(
+    VariableDomain<value_type, Compare, Storage, Allocator>& domain,
+    const value_type& value
+): m_domain(domain), m_list(nullptr)
+{
+    typename domain_type::exclusive_guard guard(domain.m_mutex);
+    m_domain.get().subscribeVariable(this, domain.locateAddress(value));
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::DomainRestrictedVariable(
+    VariableDomain<value_type, Compare, Storage, Allocator>& domain
+): m_domain(domain), m_list(nullptr)
+{
+    typename domain_type::exclusive_guard guard(domain.m_mutex);
+    m_domain.get().subscribeVariable(this, nullptr);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::DomainRestrictedVariable(
+    const DomainRestrictedVariable& other
+): drv_detail::list_hook(), m_domain(other.m_domain), m_list(nullptr)
+{
+    typename domain_type::exclusive_guard guard(m_domain.get().m_mutex);
+    m_domain.get().subscribeCopy(this, &other);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::DomainRestrictedVariable(
+    DomainRestrictedVariable&& other
+): drv_detail::list_hook(), m_domain(other.m_domain), m_list(nullptr)
+{
+    typename domain_type::exclusive_guard guard(m_domain.get().m_mutex);
+    m_domain.get().subscribeCopy(this, &other);
+    m_domain.get().reassignVariable(&other, nullptr);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::~DomainRestrictedVariable() {
+    typename domain_type::exclusive_guard guard(m_domain.get().m_mutex);
+    m_domain.get().unsubscribeVariable(this);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainRestrictedVariable<value_type, Compare, Storage, Allocator>&
+    DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::operator=(
+    const DomainRestrictedVariable& other
+) {
+    if(&other == this) {
+        return *this;
+    }
+    {
+        typename domain_type::exclusive_guard guard(m_domain.get().m_mutex);
+        m_domain.get().unsubscribeVariable(this);
+    }
+    m_domain = other.m_domain;
+    typename domain_type::exclusive_guard guard(m_domain.get().m_mutex);
+    m_domain.get().subscribeCopy(this, &other);
+    return *this;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainRestrictedVariable<value_type, Compare, Storage, Allocator>&
+    DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::operator=(
+    DomainRestrictedVariable&& other
+) {
+    if(&other == this) {
+        return *this;
+    }
+    {
+        typename domain_type::exclusive_guard guard(m_domain.get().m_mutex);
+        m_domain.get().unsubscribeVariable(this);
+    }
+    m_domain = other.m_domain;
+    typename domain_type::exclusive_guard guard(m_domain.get().m_mutex);
+    m_domain.get().subscribeCopy(this, &other);
+    m_domain.get().reassignVariable(&other, nullptr);
+    return *this;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainRestrictedVariable<value_type, Compare, Storage, Allocator>&
+    DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::operator=(
+    const value_type& value
+) {
+    typename domain_type::exclusive_guard guard(m_domain.get().m_mutex);
+    assign(m_domain.get().locateAddress(value));
+    return *this;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::clear() {
+    typename domain_type::exclusive_guard guard(m_domain.get().m_mutex);
+    assign(nullptr);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::has_value() const {
+    return get() != nullptr;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+const value_type& DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::value() const {
+    return *get();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::operator const value_type&() const {
+    return *get();
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator==(
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    //A domain holds each value once, so within one domain equal values are
+    //the very same value
+    if(&lhs.m_domain.get() == &rhs.m_domain.get()) {
+        return lhs.get() == rhs.get();
+    }
+    return Compare()(lhs, rhs) == Compare()(rhs, lhs);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator!=(
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    return !(lhs == rhs);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator<(
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    return Compare()(lhs, rhs);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator>(
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    return rhs < lhs;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator<=(
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    return !(lhs > rhs);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator>=(
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const DomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    return !(lhs < rhs);
+}
+
+//The domain may be replacing the value of the list in another thread
+template<class value_type, class Compare, class Storage, class Allocator>
+const value_type* DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::get() const {
+    typename domain_type::shared_guard guard(m_domain.get().m_mutex);
+    return m_list->value;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+void DomainRestrictedVariable<value_type, Compare, Storage, Allocator>::assign(
+    const value_type* value
+) {
+    m_domain.get().reassignVariable(this, value);
+}
+
+//A variable of a VariableDomain that does not subscribe to it. It keeps the
+//generation slot of its value and the generation it saw instead of the
+//value itself, and finds out that the value left the domain (or was
+//replaced) the next time it is read. Removing a value then costs the same
+//however many lazy variables hold it, and creating, copying or destroying
+//one never touches the domain.
+//Assigning a value creates its slot the first time it is held.
+//WARNING:  The domain does not know about lazy variables, so nothing stops
+//          it from being destroyed before them
+template<class value_type, class Compare, class Storage, class Allocator>
+class LazyDomainRestrictedVariable {
+    public:
+    LazyDomainRestrictedVariable(
+        VariableDomain<value_type, Compare, Storage, Allocator>& domain,
+        const value_type& value
+    );
+    LazyDomainRestrictedVariable(
+        VariableDomain<value_type, Compare, Storage, Allocator>& domain
+    );
+
+    LazyDomainRestrictedVariable& operator=(const value_type& value);
+
+    void clear();
+    bool has_value() const;
+
+    //WARNING:  If the variable is uninitialized or cleared, or its value
+    //          left the domain, this method has undefined behaviour
+    const value_type& value() const;
+    operator const value_type&() const;
+
+    private:
+    using domain_type = VariableDomain<value_type, Compare, Storage, Allocator>;
+
+    std::reference_wrapper<VariableDomain<value_type, Compare, Storage, Allocator>> m_domain;
+    std::size_t m_slot;
+    //Zero when the variable holds no value, slots start at generation one
+    std::uint64_t m_generation;
+
+    const value_type* get() const;
+};
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator==(
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    return !Compare()(lhs, rhs) && !Compare()(rhs, lhs);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator!=(
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    return !(lhs == rhs);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator<(
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    return Compare()(lhs, rhs);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator>(
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    return rhs < lhs;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator<=(
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    return !(lhs > rhs);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+bool operator>=(
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& lhs,
+    const LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>& rhs
+) {
+    return !(lhs < rhs);
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::LazyDomainRestrictedVariable(
+    VariableDomain<value_type, Compare, Storage, Allocator>& domain,
+    const value_type& value
+): m_domain(domain), m_slot(0), m_generation(0)
+{
+    *this = value;
+}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::LazyDomainRestrictedVariable(
+    VariableDomain<value_type, Compare, Storage, Allocator>& domain
+): m_domain(domain), m_slot(0), m_generation(0) {}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>&
+    LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::operator=(
+    const value_type& value
+) {
+    typename domain_type::exclusive_guard guard(m_domain.get().m_mutex);
+    const value_type* ptr = m_domain.get().locateAddress(value);
+    if(ptr == nullptr) {
+        clear();
+        return *this;
+    }
+    m_slot = m_domain.get().slotOf(ptr);
+    m_generation = m_domain.get().m_slots[m_slot].generation;
+    return *this;
 }
 
-template<class value_type, class Compare>
-typename VariableDomain<value_type, Compare>::const_iterator
-    VariableDomain<value_type, Compare>::cbegin() const
-{
-    return m_allowed_values.cbegin();
+template<class value_type, class Compare, class Storage, class Allocator>
+void LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::clear() {
+    m_slot = 0;
+    m_generation = 0;
 }
 
-template<class value_type, class Compare>
-typename VariableDomain<value_type, Compare>::const_iterator
-    VariableDomain<value_type, Compare>::end() const
-{
-    return m_allowed_values.end();
+template<class value_type, class Compare, class Storage, class Allocator>
+bool LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::has_value() const {
+    return get() != nullptr;
 }
 
-template<class value_type, class Compare>
-typename VariableDomain<value_type, Compare>::const_iterator
-    VariableDomain<value_type, Compare>::cend() const
-{
-    return m_allowed_values.cend();
+template<class value_type, class Compare, class Storage, class Allocator>
+const value_type& LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::value() const {
+    return *get();
 }
 
-template<class value_type, class Compare>
-typename VariableDomain<value_type, Compare>::const_reverse_iterator
-    VariableDomain<value_type, Compare>::rbegin() const
-{
-    return m_allowed_values.rbegin();
+template<class value_type, class Compare, class Storage, class Allocator>
+LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::operator const value_type&() const {
+    return *get();
 }
 
-template<class value_type, class Compare>
-typename VariableDomain<value_type, Compare>::const_reverse_iterator
-    VariableDomain<value_type, Compare>::crbegin() const
-{
-    return m_allowed_values.crbegin();
+template<class value_type, class Compare, class Storage, class Allocator>
+const value_type* LazyDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::get() const {
+    return m_generation == 0 ? nullptr : m_domain.get().resolveSlot(m_slot, m_generation);
 }
 
-template<class value_type, class Compare>
-typename VariableDomain<value_type, Compare>::const_reverse_iterator
-    VariableDomain<value_type, Compare>::rend() const
-{
-    return m_allowed_values.rend();
+//A reference to a value of a VariableDomain that fits in 8 bytes and is
+//trivially copyable, for keeping huge numbers of them in arrays. Like a lazy
+//variable it keeps the generation slot of its value and the generation it
+//saw, but not the domain: reading it goes through the domain that made it,
+//
+//  DomainValueRef<int> ref = domain.makeRef(404);
+//  const int* status = domain.resolve(ref);  //null once 404 is removed
+//
+//Passing a reference to another domain has undefined behaviour. The
+//generation is kept modulo 2^32, so a reference made before 2^32 removals
+//of values sharing its slot may resolve to a later value.
+template<class value_type, class Compare, class Storage, class Allocator>
+class DomainValueRef {
+    friend class VariableDomain<value_type, Compare, Storage, Allocator>;
+
+    public:
+    //A null reference
+    DomainValueRef() noexcept: m_slot(0), m_generation(0) {}
+
+    bool is_null() const noexcept { return m_generation == 0; }
+
+    private:
+    DomainValueRef(std::uint32_t slot, std::uint32_t generation) noexcept:
+        m_slot(slot), m_generation(generation) {}
+
+    std::uint32_t m_slot;
+    std::uint32_t m_generation;
+};
+
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainValueRef<value_type, Compare, Storage, Allocator>
+    VariableDomain<value_type, Compare, Storage, Allocator>::makeRef(
+    const value_type& value
+) {
+    //A value that already has a slot only needs the shared lock
+    {
+        read_guard guard(m_mutex, [this] { return lookupStale(); });
+        const value_type* ptr = locate(value);
+        if(ptr == nullptr) {
+            //Materialized storages give a value an address only to hold it
+            if(!drv_detail::is_materialized<storage_type>::value
+                || !contains(value, drv_detail::is_materialized<storage_type>()))
+            {
+                return DomainValueRef<value_type, Compare, Storage, Allocator>();
+            }
+        } else {
+            std::size_t slot = findSlot(ptr);
+            if(slot != SIZE_MAX) {
+                return refTo(slot);
+            }
+        }
+    }
+
+    exclusive_guard guard(m_mutex);
+    const value_type* ptr = locateAddress(value);
+    if(ptr == nullptr) {
+        return DomainValueRef<value_type, Compare, Storage, Allocator>();
+    }
+    return refTo(slotOf(ptr));
 }
 
-template<class value_type, class Compare>
-typename VariableDomain<value_type, Compare>::const_reverse_iterator
-    VariableDomain<value_type, Compare>::crend() const
-{
-    return m_allowed_values.crend();
+//Takes no lock, as resolveSlot
+template<class value_type, class Compare, class Storage, class Allocator>
+const value_type* VariableDomain<value_type, Compare, Storage, Allocator>::resolve(
+    DomainValueRef<value_type, Compare, Storage, Allocator> ref
+) const {
+    if(ref.is_null()) {
+        return nullptr;
+    }
+    const typename drv_detail::slot_table<value_type, Allocator>::slot& entry = m_slots[ref.m_slot];
+    if(static_cast<std::uint32_t>(entry.generation.load()) != ref.m_generation) {
+        return nullptr;
+    }
+    const value_type* value = entry.value.load();
+    return static_cast<std::uint32_t>(entry.generation.load()) == ref.m_generation ? value : nullptr;
 }
 
-template<class value_type, class Compare>
-bool VariableDomain<value_type, Compare>::isAllowedValue(
+#if __cplusplus >= 201703L
+//A variable of a VariableDomain over a ConcurrentStorage that several
+//threads can load and store at once, such as a state shared by the threads
+//of a connection. It is a std::atomic DomainValueRef, 8 bytes, and like a
+//reference it does not keep its domain: every call that needs the domain
+//takes it, and like a lazy variable it finds out that its value left the
+//domain the next time it is read.
+//load() and exchange() return a copy of the value, taken under the domain's
+//shared lock, so that another thread removing the value cannot free it
+//while it is read. The overloads taking values look them up first, under
+//the shared lock, and under the exclusive one the first time a value is
+//held. loadRef(), clear() and store() of a reference only touch the atomic;
+//keep references of frequently stored values around to stay clear of the
+//exclusive lock:
+//
+//  auto idle = states.makeRef("idle"), busy = states.makeRef("busy");
+//  if(state.compare_exchange(states, idle, busy)) { ... }
+//
+//WARNING:  Every call has to be given the domain the variable's references
+//          came from, and that domain has to outlive the variable; another
+//          domain has undefined behaviour
+template<class value_type, class Compare, class Storage, class Allocator>
+class AtomicDomainRestrictedVariable {
+    static_assert(drv_detail::is_concurrent<
+        typename Storage::template storage<value_type, Compare, Allocator>>::value,
+        "An AtomicDomainRestrictedVariable needs a VariableDomain over a ConcurrentStorage.");
+
+    public:
+    using domain_type = VariableDomain<value_type, Compare, Storage, Allocator>;
+    using ref_type = DomainValueRef<value_type, Compare, Storage, Allocator>;
+
+    //A variable holding no value
+    AtomicDomainRestrictedVariable() noexcept;
+    explicit AtomicDomainRestrictedVariable(ref_type ref) noexcept;
+    //Holds nothing if value is not allowed
+    AtomicDomainRestrictedVariable(domain_type& domain, const value_type& value);
+
+    AtomicDomainRestrictedVariable(const AtomicDomainRestrictedVariable& other) = delete;
+    AtomicDomainRestrictedVariable& operator=(const AtomicDomainRestrictedVariable& other) = delete;
+
+    //A copy of the value held, or nothing if there is none or it left the
+    //domain
+    std::optional<value_type> load(const domain_type& domain) const;
+    //The reference held, for domain.resolve() or a later store
+    ref_type loadRef() const noexcept;
+    //Stores value, or clears the variable if value is not allowed
+    void store(domain_type& domain, const value_type& value);
+    void store(ref_type ref) noexcept;
+    void clear() noexcept;
+    //store, returning what load would have returned just before
+    std::optional<value_type> exchange(domain_type& domain, const value_type& value);
+    std::optional<value_type> exchange(const domain_type& domain, ref_type ref);
+    //Stores desired only if the variable holds expected (the very value of
+    //the domain, not one that was replaced by it) and desired is allowed;
+    //otherwise returns false and leaves the variable as it was
+    bool compare_exchange(domain_type& domain, const value_type& expected, const value_type& desired);
+    bool compare_exchange(const domain_type& domain, ref_type expected, ref_type desired);
+
+    //Whether loadRef(), clear() and store() of a reference are lock-free;
+    //the others take the domain's shared lock
+    bool is_lock_free() const noexcept;
+
+    private:
+    std::atomic<ref_type> m_ref;
+};
+
+template<class value_type, class Compare, class Storage, class Allocator>
+AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::AtomicDomainRestrictedVariable() noexcept:
+    m_ref(ref_type()) {}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::AtomicDomainRestrictedVariable(
+    ref_type ref
+) noexcept: m_ref(ref) {}
+
+template<class value_type, class Compare, class Storage, class Allocator>
+AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::AtomicDomainRestrictedVariable(
+    domain_type& domain,
     const value_type& value
+): m_ref(domain.makeRef(value)) {}
+
+//Values only leave the domain under its exclusive lock, so the one resolved
+//stays alive until the copy is made
+template<class value_type, class Compare, class Storage, class Allocator>
+std::optional<value_type> AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::load(
+    const domain_type& domain
 ) const {
-    return m_allowed_values.find(value) != m_allowed_values.end();
+    typename domain_type::shared_guard guard(domain.m_mutex);
+    const value_type* value = domain.resolve(m_ref.load());
+    return value == nullptr ? std::nullopt : std::optional<value_type>(*value);
 }
 
-#if __cplusplus >= 201402L
-template<class value_type, class Compare>
-template<class K>
-bool VariableDomain<value_type, Compare>::isAllowedValue(
-    K&& x
-) const {
-    return m_allowed_values.find(x) != m_allowed_values.end();
+template<class value_type, class Compare, class Storage, class Allocator>
+typename AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::ref_type
+    AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::loadRef() const noexcept
+{
+    return m_ref.load();
 }
-#endif
 
-template<class value_type, class Compare>
-bool VariableDomain<value_type, Compare>::addAllowedValue(
+template<class value_type, class Compare, class Storage, class Allocator>
+void AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::store(
+    domain_type& domain,
     const value_type& value
 ) {
-    return m_allowed_values.insert(value).second;
+    store(domain.makeRef(value));
 }
 
-template<class value_type, class Compare>
-bool VariableDomain<value_type, Compare>::addAllowedValue(
-    value_type&& value
-) {
-    return m_allowed_values.insert(std::forward(value)).second;
+template<class value_type, class Compare, class Storage, class Allocator>
+void AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::store(
+    ref_type ref
+) noexcept {
+    m_ref.store(ref);
 }
 
-template<class value_type, class Compare>
-template<class InputIt>
-void VariableDomain<value_type, Compare>::addAllowedValuesRange(
-    InputIt first, InputIt last
+template<class value_type, class Compare, class Storage, class Allocator>
+void AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::clear() noexcept {
+    m_ref.store(ref_type());
+}
+
+//makeRef may need the exclusive lock, so it comes before the shared one
+template<class value_type, class Compare, class Storage, class Allocator>
+std::optional<value_type> AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::exchange(
+    domain_type& domain,
+    const value_type& value
 ) {
-    m_allowed_values.insert(first, last);
+    return exchange(domain, domain.makeRef(value));
 }
 
-template<class value_type, class Compare>
-void VariableDomain<value_type, Compare>::addAllowedValues(
-    std::initializer_list<value_type> ilist
+template<class value_type, class Compare, class Storage, class Allocator>
+std::optional<value_type> AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::exchange(
+    const domain_type& domain,
+    ref_type ref
 ) {
-    m_allowed_values.insert(ilist);
+    typename domain_type::shared_guard guard(domain.m_mutex);
+    const value_type* previous = domain.resolve(m_ref.exchange(ref));
+    return previous == nullptr ? std::nullopt : std::optional<value_type>(*previous);
 }
 
-template<class value_type, class Compare>
-template<class... Args>
-bool VariableDomain<value_type, Compare>::emplaceAllowedValue(
-    Args&&... args
+template<class value_type, class Compare, class Storage, class Allocator>
+bool AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::compare_exchange(
+    domain_type& domain,
+    const value_type& expected,
+    const value_type& desired
 ) {
-    return m_allowed_values.emplace(std::forward(args)...);
+    return compare_exchange(domain, domain.makeRef(expected), domain.makeRef(desired));
 }
 
-template<class value_type, class Compare>
-bool VariableDomain<value_type, Compare>::removeAllowedValue(
-    const value_type& value
+//A value may have several references (it inherits those of the values it
+//replaced), so the one held is compared by what it resolves to. Under the
+//shared lock no value leaves the domain, so an address resolved here cannot
+//be freed and taken by another value before the exchange
+template<class value_type, class Compare, class Storage, class Allocator>
+bool AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::compare_exchange(
+    const domain_type& domain,
+    ref_type expected,
+    ref_type desired
 ) {
-    auto iter = m_allowed_values.find(value);
-    if(value == m_allowed_values.end()) {
+    typename domain_type::shared_guard guard(domain.m_mutex);
+    const value_type* held = domain.resolve(expected);
+    if(held == nullptr || domain.resolve(desired) == nullptr) {
         return false;
     }
-
-    deletionNotice(iter);
-    m_allowed_values.erase(iter);
+    ref_type current = m_ref.load();
+    do {
+        if(domain.resolve(current) != held) {
+            return false;
+        }
+    } while(!m_ref.compare_exchange_weak(current, desired));
     return true;
 }
 
-template<class value_type, class Compare>
-void VariableDomain<value_type, Compare>::removeAllowedValues(
-    std::initializer_list<value_type> ilist
-) {
-    for(auto& value : ilist) {
-        removeAllowedValue(value);
-    }
+template<class value_type, class Compare, class Storage, class Allocator>
+bool AtomicDomainRestrictedVariable<value_type, Compare, Storage, Allocator>::is_lock_free() const noexcept {
+    return m_ref.is_lock_free();
 }
+#endif
 
-template<class value_type, class Compare>
-bool VariableDomain<value_type, Compare>::replaceAllowedValue(
-    const value_type& to_replace,
-    const value_type& replacement
-) {
-    auto iter = m_allowed_values.find(to_replace);
-    if(iter == m_allowed_values.end()) {
-        return false;
-    }
+//The values a VariableDomain had when a snapshot was published, sorted by
+//Compare, from VariableDomain::snapshot(). Taking and dropping one costs a
+//few atomic operations; looking values up in it costs none, and nothing a
+//writer does to the domain changes it. Keeping one around delays freeing
+//the copies published after it, so readers should take a fresh one for
+//every batch of work rather than keep one for good.
+template<class value_type, class Compare, class Storage, class Allocator>
+class DomainSnapshot {
+    friend class VariableDomain<value_type, Compare, Storage, Allocator>;
+    using reclaimer_type = drv_detail::epoch_reclaimer<std::vector<value_type>>;
 
-    auto pair = m_allowed_values.insert(replacement);
+    public:
+    using const_iterator = typename std::vector<value_type>::const_iterator;
 
-    replacementNotice(iter, pair.first);
+    DomainSnapshot(const DomainSnapshot& other) = delete;
+    DomainSnapshot(DomainSnapshot&& other) noexcept;
 
-    m_allowed_values.erase(iter);
-    return true;
-}
+    DomainSnapshot& operator=(const DomainSnapshot& other) = delete;
+    DomainSnapshot& operator=(DomainSnapshot&& other) = delete;
 
-template<class value_type, class Compare>
-bool VariableDomain<value_type, Compare>::replaceAllowedValue(
-    const value_type& to_replace,
-    value_type&& replacement
-) {
-    auto iter = m_allowed_values.find(to_replace);
-    if(iter == m_allowed_values.end()) {
-        return false;
-    }
+    ~DomainSnapshot();
 
-    auto pair = m_allowed_values.insert(std::forward(replacement));
+    bool isAllowedValue(const value_type& value) const;
 
-    replacementNotice(iter, pair.first);
+    const_iterator begin() const;
+    const_iterator end() const;
+    std::size_t size() const;
 
-    m_allowed_values.erase(iter);
-    return true;
-}
+    private:
+    explicit DomainSnapshot(reclaimer_type& reclaimer);
 
-template<class value_type, class Compare>
-void VariableDomain<value_type, Compare>::subscribeVariable(
-    const DomainRestrictedVariable<value_type, Compare>* const ptr
-) {
-    m_managed_variables.insert(ptr);
-}
+    //Null once moved from
+    reclaimer_type* m_reclaimer;
+    std::size_t m_slot;
+    const std::vector<value_type>* m_values;
+};
 
-template<class value_type, class Compare>
-void VariableDomain<value_type, Compare>::unsubscribeVariable(
-    const DomainRestrictedVariable<value_type, Compare>* const ptr
-) {
-    m_managed_variables.erase(ptr);
-}
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainSnapshot<value_type, Compare, Storage, Allocator>::DomainSnapshot(
+    reclaimer_type& reclaimer
+): m_reclaimer(&reclaimer), m_slot(0), m_values(reclaimer.enter(m_slot)) {}
 
-template<class value_type, class Compare>
-void VariableDomain<value_type, Compare>::deletionNotice(
-    value_type* to_delete
-) {
-    for(auto& var : m_managed_variables) {
-        var->deletionNotice(to_delete);
-    }
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainSnapshot<value_type, Compare, Storage, Allocator>::DomainSnapshot(
+    DomainSnapshot&& other
+) noexcept: m_reclaimer(other.m_reclaimer), m_slot(other.m_slot), m_values(other.m_values)
+{
+    other.m_reclaimer = nullptr;
 }
 
-template<class value_type, class Compare>
-void VariableDomain<value_type, Compare>::replacementNotice(
-    value_type* to_replace,
-    value_type* replacement
-) {
-    for(auto& var : m_managed_variables) {
-        var->replacementNotice(to_replace, replacement);
+template<class value_type, class Compare, class Storage, class Allocator>
+DomainSnapshot<value_type, Compare, Storage, Allocator>::~DomainSnapshot() {
+    if(m_reclaimer != nullptr) {
+        m_reclaimer->leave(m_slot);
     }
 }
 
-template<class value_type, class Compare>
-DomainRestrictedVariable<value_type, Compare>::DomainRestrictedVariable(
-    VariableDomain<value_type, Compare>& domain,
+template<class value_type, class Compare, class Storage, class Allocator>
+bool DomainSnapshot<value_type, Compare, Storage, Allocator>::isAllowedValue(
     const value_type& value
-): m_domain(domain), m_value(domain.find(value))
-{
-    m_domain.get().subscribeVariable(this);
+) const {
+    return std::binary_search(m_values->begin(), m_values->end(), value, Compare());
 }
 
-template<class value_type, class Compare>
-DomainRestrictedVariable<value_type, Compare>::DomainRestrictedVariable(
-    VariableDomain<value_type, Compare>& domain
-): m_domain(domain), m_value(domain.m_allowed_values.end())
+template<class value_type, class Compare, class Storage, class Allocator>
+typename DomainSnapshot<value_type, Compare, Storage, Allocator>::const_iterator
+    DomainSnapshot<value_type, Compare, Storage, Allocator>::begin() const
 {
-    m_domain.get().subscribeVariable(this);
+    return m_values->begin();
 }
 
-template<class value_type, class Compare>
-DomainRestrictedVariable<value_type, Compare>::DomainRestrictedVariable(
-    const DomainRestrictedVariable& other
-): m_domain(other.m_domain), m_value(other.m_value)
+template<class value_type, class Compare, class Storage, class Allocator>
+typename DomainSnapshot<value_type, Compare, Storage, Allocator>::const_iterator
+    DomainSnapshot<value_type, Compare, Storage, Allocator>::end() const
 {
-    m_domain.get().subscribeVariable(this);
+    return m_values->end();
 }
 
-template<class value_type, class Compare>
-DomainRestrictedVariable<value_type, Compare>::DomainRestrictedVariable(
-    DomainRestrictedVariable&& other
-): m_domain(other.m_domain), m_value(other.m_value)
-{
-    other.clear();
-    m_domain.get().unsubscribeVariable(&other);
-    m_domain.get().subscribeVariable(this);
+template<class value_type, class Compare, class Storage, class Allocator>
+std::size_t DomainSnapshot<value_type, Compare, Storage, Allocator>::size() const {
+    return m_values->size();
 }
 
-template<class value_type, class Compare>
-DomainRestrictedVariable<value_type, Compare>::~DomainRestrictedVariable() {
-    m_domain.get().unsubscribeVariable(this);
-}
+//A VariableDomain whose values are known at compile time. It needs no heap
+//allocation, answers contains() in constant expressions, and turns a literal
+//outside of the domain into a compilation error:
+//
+//  using HttpStatus = StaticVariableDomain<int, 200, 404, 500>;
+//  static_assert(HttpStatus::contains(404), "");
+//  DomainRestrictedVariable<int, std::less<int>, HttpStatus::storage_policy> status(domain);
+//  status = HttpStatus::literal<404>();
+template<class value_type, value_type... values>
+class StaticVariableDomain:
+    public VariableDomain<value_type, std::less<value_type>, StaticStorage<value_type, values...>>
+{
+    public:
+    using storage_policy = StaticStorage<value_type, values...>;
 
-template<class value_type, class Compare>
-DomainRestrictedVariable<value_type, Compare>&
-    DomainRestrictedVariable<value_type, Compare>::operator=(
-    const DomainRestrictedVariable& other
-) {
-    m_domain.get().unsubscribeVariable(this);
-    m_domain = other.m_domain;
-    m_domain.get().subscribeVariable(this);
-    m_value = other.m_value;
-}
+    StaticVariableDomain();
 
-template<class value_type, class Compare>
-DomainRestrictedVariable<value_type, Compare>&
-    DomainRestrictedVariable<value_type, Compare>::operator=(
-    DomainRestrictedVariable&& other
-) {
-    m_domain.get().unsubscribeVariable(this);
-    other.m_domain.get().unsubscribeVariable(&other);
-    m_domain = other.m_domain;
-    m_domain.get().subscribeVariable(this);
-    m_value = other.m_value;
-    other.clear();
-}
+    static constexpr bool contains(value_type value);
 
-template<class value_type, class Compare>
-DomainRestrictedVariable<value_type, Compare>&
-    DomainRestrictedVariable<value_type, Compare>::operator=(
-    const value_type& value
+    template<value_type value>
+    static constexpr value_type literal();
+};
+
+template<class value_type, value_type... values>
+StaticVariableDomain<value_type, values...>::StaticVariableDomain():
+    VariableDomain<value_type, std::less<value_type>, storage_policy>() {}
+
+template<class value_type, value_type... values>
+constexpr bool StaticVariableDomain<value_type, values...>::contains(
+    value_type value
 ) {
-    m_value = m_domain.get().m_allowed_values.find(value);
+    return drv_detail::static_values<value_type, values...>::contains(value);
 }
 
-template<class value_type, class Compare>
-void DomainRestrictedVariable<value_type, Compare>::clear() {
-    m_value = nullptr;
+template<class value_type, value_type... values>
+template<value_type value>
+constexpr value_type StaticVariableDomain<value_type, values...>::literal() {
+    static_assert(drv_detail::static_values<value_type, values...>::contains(value),
+        "The literal is not part of the StaticVariableDomain.");
+    return value;
 }
 
-template<class value_type, class Compare>
-bool DomainRestrictedVariable<value_type, Compare>::has_value() const {
-    return m_value != nullptr;
+#if __cplusplus >= 201703L
+//A domain split into shards, VariableDomain(s) over ConcurrentStorage<Inner>
+//with a lock each, for values added and checked from many threads at once.
+//Each value lives in the shard its hash picks, so threads touching
+//different shards do not wait for each other. Checks and single-value
+//changes lock one shard; the range versions sort the values by shard first
+//and take each lock once.
+//Variables subscribe to a shard, shardOf(value), which notifies them (and
+//its listeners) like any domain. A variable can only be assigned the values
+//of its shard: the others are not allowed there.
+//allowedValues() merges the shards back into Compare order.
+template<
+    class value_type,
+    class Compare = std::less<value_type>,
+    class Inner = SetStorage,
+    class Hash = std::hash<value_type>,
+    class Allocator = std::allocator<value_type>>
+class ShardedVariableDomain {
+    public:
+    using shard_type = VariableDomain<value_type, Compare, ConcurrentStorage<Inner>, Allocator>;
+    using variable_type = DomainRestrictedVariable<value_type, Compare, ConcurrentStorage<Inner>, Allocator>;
+
+    explicit ShardedVariableDomain(
+        std::size_t shards = 16,
+        const Compare& comp = Compare(),
+        const Hash& hash = Hash(),
+        const Allocator& alloc = Allocator()
+    );
+    ShardedVariableDomain(
+        std::initializer_list<value_type> ilist,
+        std::size_t shards = 16,
+        const Compare& comp = Compare(),
+        const Hash& hash = Hash(),
+        const Allocator& alloc = Allocator()
+    );
+
+    ShardedVariableDomain(const ShardedVariableDomain& other) = delete;
+    ShardedVariableDomain& operator=(const ShardedVariableDomain& other) = delete;
+
+    //Check
+    bool isAllowedValue(const value_type& value) const;
+
+    //Addition
+    bool addAllowedValue(const value_type& value);
+    template<class InputIt>
+    void addAllowedValuesRange(InputIt first, InputIt last);
+    void addAllowedValues(std::initializer_list<value_type> ilist);
+
+    //Removal
+    bool removeAllowedValue(const value_type& value);
+    template<class InputIt>
+    void removeAllowedValuesRange(InputIt first, InputIt last);
+    void removeAllowedValues(std::initializer_list<value_type> ilist);
+
+    //Replacement
+    //Within a shard, the holders of to_replace follow it as usual. When the
+    //replacement belongs to another shard, it is added there and to_replace
+    //removed, which clears its holders, with both shards locked throughout.
+    bool replaceAllowedValue(const value_type& to_replace, const value_type& replacement);
+
+    //Retrieval
+    //Every value, in Compare order: a copy of each shard, merged
+    std::vector<value_type> allowedValues() const;
+
+    //Shards
+    std::size_t shardCount() const;
+    shard_type& shard(std::size_t index);
+    const shard_type& shard(std::size_t index) const;
+    shard_type& shardOf(const value_type& value);
+    const shard_type& shardOf(const value_type& value) const;
+
+    private:
+    Compare m_comp;
+    Hash m_hash;
+    std::vector<shard_type> m_shards;
+
+    std::size_t indexOf(const value_type& value) const;
+    //The values of [first, last), by shard
+    template<class InputIt>
+    std::vector<std::vector<value_type>> bucket(InputIt first, InputIt last) const;
+};
+
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::ShardedVariableDomain(
+    std::size_t shards,
+    const Compare& comp,
+    const Hash& hash,
+    const Allocator& alloc
+): m_comp(comp), m_hash(hash), m_shards()
+{
+    if(shards == 0) {
+        throw std::invalid_argument("A ShardedVariableDomain needs at least one shard.");
+    }
+    m_shards.reserve(shards);
+    for(std::size_t i = 0; i < shards; ++i) {
+        m_shards.emplace_back(comp, alloc);
+    }
 }
 
-template<class value_type, class Compare>
-const value_type& DomainRestrictedVariable<value_type, Compare>::value() const {
-    return *m_value;
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::ShardedVariableDomain(
+    std::initializer_list<value_type> ilist,
+    std::size_t shards,
+    const Compare& comp,
+    const Hash& hash,
+    const Allocator& alloc
+): ShardedVariableDomain(shards, comp, hash, alloc)
+{
+    addAllowedValuesRange(ilist.begin(), ilist.end());
 }
 
-template<class value_type, class Compare>
-DomainRestrictedVariable<value_type, Compare>::operator const value_type&() const {
-    return *m_value;
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+bool ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::isAllowedValue(
+    const value_type& value
+) const {
+    return shardOf(value).isAllowedValue(value);
 }
 
-template<class value_type, class Compare>
-bool operator==(
-    const DomainRestrictedVariable<value_type, Compare>& lhs,
-    const DomainRestrictedVariable<value_type, Compare>& rhs
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+bool ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::addAllowedValue(
+    const value_type& value
 ) {
-    return Compare()(lhs, rhs) == Compare()(rhs, lhs);
+    return shardOf(value).addAllowedValue(value);
 }
 
-template<class value_type, class Compare>
-bool operator!=(
-    const DomainRestrictedVariable<value_type, Compare>& lhs,
-    const DomainRestrictedVariable<value_type, Compare>& rhs
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+template<class InputIt>
+void ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::addAllowedValuesRange(
+    InputIt first, InputIt last
 ) {
-    return !(lhs == rhs);
+    std::vector<std::vector<value_type>> buckets = bucket(first, last);
+    for(std::size_t i = 0; i < buckets.size(); ++i) {
+        if(!buckets[i].empty()) {
+            m_shards[i].addAllowedValuesRange(buckets[i].begin(), buckets[i].end());
+        }
+    }
 }
 
-template<class value_type, class Compare>
-bool operator<(
-    const DomainRestrictedVariable<value_type, Compare>& lhs,
-    const DomainRestrictedVariable<value_type, Compare>& rhs
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+void ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::addAllowedValues(
+    std::initializer_list<value_type> ilist
 ) {
-    return Compare()(lhs, rhs);
+    addAllowedValuesRange(ilist.begin(), ilist.end());
 }
 
-template<class value_type, class Compare>
-bool operator>(
-    const DomainRestrictedVariable<value_type, Compare>& lhs,
-    const DomainRestrictedVariable<value_type, Compare>& rhs
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+bool ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::removeAllowedValue(
+    const value_type& value
 ) {
-    return rhs < lhs;
+    return shardOf(value).removeAllowedValue(value);
 }
 
-template<class value_type, class Compare>
-bool operator<=(
-    const DomainRestrictedVariable<value_type, Compare>& lhs,
-    const DomainRestrictedVariable<value_type, Compare>& rhs
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+template<class InputIt>
+void ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::removeAllowedValuesRange(
+    InputIt first, InputIt last
 ) {
-    return !(lhs > rhs);
+    std::vector<std::vector<value_type>> buckets = bucket(first, last);
+    for(std::size_t i = 0; i < buckets.size(); ++i) {
+        if(!buckets[i].empty()) {
+            m_shards[i].removeAllowedValuesRange(buckets[i].begin(), buckets[i].end());
+        }
+    }
 }
 
-template<class value_type, class Compare>
-bool operator>=(
-    const DomainRestrictedVariable<value_type, Compare>& lhs,
-    const DomainRestrictedVariable<value_type, Compare>& rhs
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+void ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::removeAllowedValues(
+    std::initializer_list<value_type> ilist
 ) {
-    return !(lhs < rhs);
+    removeAllowedValuesRange(ilist.begin(), ilist.end());
 }
 
-template<class value_type, class Compare>
-void DomainRestrictedVariable<value_type, Compare>::deletionNotice(
-    value_type* to_delete
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+bool ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::replaceAllowedValue(
+    const value_type& to_replace,
+    const value_type& replacement
 ) {
-    if(m_value == to_delete) {
-        clear();
+    shard_type& from = shardOf(to_replace);
+    shard_type& to = shardOf(replacement);
+    if(&from == &to) {
+        return from.replaceAllowedValue(to_replace, replacement);
+    }
+
+    //Both shards stay locked throughout, the one at the lower address first,
+    //so that no thread sees the value in neither or both of them
+    bool from_first = std::less<const shard_type*>()(&from, &to);
+    typename shard_type::exclusive_guard first_guard((from_first ? from : to).m_mutex);
+    typename shard_type::exclusive_guard second_guard((from_first ? to : from).m_mutex);
+    if(from.m_frozen || to.m_frozen || from.locate(to_replace) == nullptr) {
+        return false;
     }
+    if(!to.add(replacement) && to.locate(replacement) == nullptr) {
+        return false;
+    }
+    return from.remove(to_replace);
 }
 
-template<class value_type, class Compare>
-void DomainRestrictedVariable<value_type, Compare>::replacementNotice(
-    value_type* to_replace,
-    value_type* replacement
-) {
-    if(m_value == to_replace) {
-        m_value = replacement;
+//A heap of the next value of every shard, smallest on top
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+std::vector<value_type> ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::allowedValues() const {
+    using cursor = std::pair<
+        typename std::vector<value_type>::const_iterator,
+        typename std::vector<value_type>::const_iterator>;
+
+    std::vector<std::vector<value_type>> copies;
+    copies.reserve(m_shards.size());
+    std::size_t total = 0;
+    for(const shard_type& shard : m_shards) {
+        copies.push_back(shard.allowedValues());
+        //Unordered storages iterate in any order
+        std::sort(copies.back().begin(), copies.back().end(), m_comp);
+        total += copies.back().size();
+    }
+
+    std::vector<cursor> heap;
+    for(const std::vector<value_type>& copy : copies) {
+        if(!copy.empty()) {
+            heap.push_back(cursor(copy.begin(), copy.end()));
+        }
+    }
+    auto later = [this](const cursor& lhs, const cursor& rhs) {
+        return m_comp(*rhs.first, *lhs.first);
+    };
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    std::vector<value_type> values;
+    values.reserve(total);
+    while(!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        cursor& next = heap.back();
+        values.push_back(*next.first);
+        if(++next.first == next.second) {
+            heap.pop_back();
+        } else {
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+    return values;
+}
+
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+std::size_t ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::shardCount() const {
+    return m_shards.size();
+}
+
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+typename ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::shard_type&
+    ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::shard(std::size_t index)
+{
+    return m_shards.at(index);
+}
+
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+const typename ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::shard_type&
+    ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::shard(std::size_t index) const
+{
+    return m_shards.at(index);
+}
+
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+typename ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::shard_type&
+    ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::shardOf(const value_type& value)
+{
+    return m_shards[indexOf(value)];
+}
+
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+const typename ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::shard_type&
+    ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::shardOf(const value_type& value) const
+{
+    return m_shards[indexOf(value)];
+}
+
+//Mixed, and taken from the high bits, so that hash storages inside the
+//shards still see evenly spread low bits
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+std::size_t ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::indexOf(
+    const value_type& value
+) const {
+    return static_cast<std::size_t>(
+        (drv_detail::mix64(static_cast<std::uint64_t>(m_hash(value))) >> 32) % m_shards.size());
+}
+
+template<class value_type, class Compare, class Inner, class Hash, class Allocator>
+template<class InputIt>
+std::vector<std::vector<value_type>> ShardedVariableDomain<value_type, Compare, Inner, Hash, Allocator>::bucket(
+    InputIt first, InputIt last
+) const {
+    std::vector<std::vector<value_type>> buckets(m_shards.size());
+    for(; first != last; ++first) {
+        buckets[indexOf(*first)].push_back(*first);
     }
+    return buckets;
 }
 
+//A domain of interned strings and its variables. Every API takes a
+//std::string_view, and value() is a view of the domain's own copy.
+using InternedStringDomain =
+    VariableDomain<std::string_view, std::less<std::string_view>, InternedStorage<>>;
+using InternedStringVariable =
+    DomainRestrictedVariable<std::string_view, std::less<std::string_view>, InternedStorage<>>;
+
+//Domains allocating from a std::pmr::memory_resource, which their
+//constructors accept in place of an allocator:
+//
+//  std::byte buffer[4096];
+//  std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+//  PmrVariableDomain<int> domain({1, 2, 3}, std::less<int>(), &arena);
+//
+//The storage and the registry of variables then live in the resource, as do
+//the contents of allocator-aware values such as std::pmr::string, so a
+//monotonic resource tears all of it down at once. The optional lookup
+//structures (perfect hash, Eytzinger copy, Bloom filter, sorted snapshot)
+//still come from the global heap.
+template<
+    class value_type,
+    class Compare = std::less<value_type>,
+    class Storage = SetStorage>
+using PmrVariableDomain =
+    VariableDomain<value_type, Compare, Storage, std::pmr::polymorphic_allocator<value_type>>;
+template<
+    class value_type,
+    class Compare = std::less<value_type>,
+    class Storage = SetStorage>
+using PmrDomainRestrictedVariable =
+    DomainRestrictedVariable<value_type, Compare, Storage, std::pmr::polymorphic_allocator<value_type>>;
+#endif
+
 #endif
@@ -0,0 +1,120 @@
+//The claims about heap traffic, counted with CountingAllocator: a domain
+//gives back everything it took, variables are copied, moved and destroyed
+//without allocating, a pooled domain stops allocating once it reached its
+//peak, and a SmallStorage domain of a few values does not allocate at all.
+#include "check.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+using counting = CountingAllocator<int>;
+
+void testCounts() {
+    AllocationCounts counts = AllocationCounts();
+    counting alloc(counts);
+    int* ints = alloc.allocate(4);
+    CHECK(counts.allocations == 1 && counts.live_bytes == 4 * sizeof(int));
+    CountingAllocator<double> rebound(alloc);
+    double* doubles = rebound.allocate(2);
+    CHECK(counts.allocations == 2 && rebound == alloc);
+    rebound.deallocate(doubles, 2);
+    alloc.deallocate(ints, 4);
+    CHECK(counts.deallocations == 2 && counts.live_bytes == 0);
+}
+
+template<class Storage>
+void testDomain() {
+    AllocationCounts counts = AllocationCounts();
+    {
+        VariableDomain<int, std::less<int>, Storage, counting> domain(
+            {1, 2, 3}, std::less<int>(), counting(counts));
+        DomainRestrictedVariable<int, std::less<int>, Storage, counting> variable(domain, 2);
+        for(int i = 10; i < 100; ++i) {
+            domain.addAllowedValue(i);
+        }
+        domain.removeAllowedValue(2);
+        CHECK(counts.allocations > 0 && !variable.has_value());
+    }
+    CHECK(counts.live_bytes == 0 && counts.allocations == counts.deallocations);
+}
+
+void testVariables() {
+    AllocationCounts counts = AllocationCounts();
+    using domain_type = VariableDomain<int, std::less<int>, SetStorage, counting>;
+    using variable_type = DomainRestrictedVariable<int, std::less<int>, SetStorage, counting>;
+    domain_type domain({1, 2, 3}, std::less<int>(), counting(counts));
+    variable_type held(domain, 1);
+    variable_type other(domain, 2);
+
+    std::size_t before = counts.allocations;
+    {
+        variable_type copy(held);
+        variable_type moved(std::move(copy));
+        variable_type assigned(domain);
+        assigned = held;
+        assigned = std::move(moved);
+        assigned = other;
+        assigned = 2;
+        CHECK(domain.useCount(1) == 1 && domain.useCount(2) == 2);
+    }
+    CHECK(counts.allocations == before);
+
+    //The first reference to a value takes a slot; later ones and lazy
+    //variables reuse it
+    LazyDomainRestrictedVariable<int, std::less<int>, SetStorage, counting> lazy(domain);
+    lazy = 3;
+    before = counts.allocations;
+    for(int i = 0; i < 100; ++i) {
+        LazyDomainRestrictedVariable<int, std::less<int>, SetStorage, counting> again(domain);
+        again = 3;
+        CHECK(domain.resolve(domain.makeRef(3)) != nullptr);
+    }
+    CHECK(counts.allocations == before);
+}
+
+void testPool() {
+    AllocationCounts counts = AllocationCounts();
+    using pooled = NodePoolAllocator<int, counting>;
+    pooled alloc((counting(counts)));
+    VariableDomain<int, std::less<int>, SetStorage, pooled> domain(alloc);
+    for(int i = 0; i < 1000; ++i) {
+        domain.addAllowedValue(i);
+    }
+    for(int i = 0; i < 1000; ++i) {
+        domain.removeAllowedValue(i);
+    }
+
+    std::size_t before = counts.allocations;
+    for(int round = 0; round < 10; ++round) {
+        for(int i = 0; i < 1000; ++i) {
+            domain.addAllowedValue(i + round);
+        }
+        for(int i = 0; i < 1000; ++i) {
+            domain.removeAllowedValue(i + round);
+        }
+    }
+    CHECK(counts.allocations == before);
+}
+
+void testSmall() {
+    AllocationCounts counts = AllocationCounts();
+    {
+        VariableDomain<int, std::less<int>, SmallStorage<8>, counting> domain(
+            {1, 2, 3, 4}, std::less<int>(), counting(counts));
+        domain.addAllowedValue(5);
+        domain.removeAllowedValue(1);
+        domain.replaceAllowedValue(2, 6);
+        CHECK(domain.isAllowedValue(6) && !domain.isAllowedValue(2));
+    }
+    CHECK(counts.allocations == 0);
+}
+
+int main() {
+    testCounts();
+    testDomain<SetStorage>();
+    testDomain<FlatStorage>();
+    testDomain<HashStorage<>>();
+    testVariables();
+    testPool();
+    testSmall();
+    return check::result();
+}
@@ -0,0 +1,91 @@
+//isAllowedValues has to agree with isAllowedValue, value by value. This
+//file is built once per instruction set (see CMakeLists.txt), so the vector
+//paths are checked against the scalar lookups on machines that have them.
+#include "check.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <random>
+
+//Whether the machine runs what the compiler was allowed to emit
+bool supported() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#if defined(__AVX2__)
+    return __builtin_cpu_supports("avx2");
+#elif defined(__SSE4_1__)
+    return __builtin_cpu_supports("sse4.1");
+#endif
+#endif
+    return true;
+}
+
+template<class T, class Storage>
+void agree(const VariableDomain<T, std::less<T>, Storage>& domain, const std::vector<T>& values) {
+    std::vector<std::uint64_t> bits((values.size() + 63) / 64 + 1, ~UINT64_C(0));
+    domain.isAllowedValues(values.data(), values.size(), bits.data());
+    for(std::size_t i = 0; i < values.size(); ++i) {
+        bool batch = (bits[i / 64] >> (i % 64)) & 1;
+        if(batch != domain.isAllowedValue(values[i])) {
+            CHECK(batch == domain.isAllowedValue(values[i]));
+            return;
+        }
+    }
+    //Bits past count are cleared in the last word, and nothing is written after it
+    if(values.size() % 64 != 0) {
+        CHECK(bits[values.size() / 64] >> (values.size() % 64) == 0);
+    }
+    CHECK(bits.back() == ~UINT64_C(0));
+}
+
+//Domains from empty to past the broadcast limit and into the binary
+//search, probed with counts that end mid-block, and with the extremes
+template<class T, class Storage = SetStorage>
+void testType() {
+    std::mt19937_64 rng(42);
+    const T lowest = std::numeric_limits<T>::lowest();
+    const T highest = std::numeric_limits<T>::max();
+    for(std::size_t size : {0, 1, 3, 16, 17, 100, 5000}) {
+        VariableDomain<T, std::less<T>, Storage> domain;
+        std::vector<T> values;
+        for(std::size_t i = 0; i < size; ++i) {
+            T value = static_cast<T>(rng() % 512) - static_cast<T>(std::is_signed<T>::value ? 256 : 0);
+            domain.addAllowedValue(value);
+            values.push_back(value);
+        }
+        if(size > 1) {
+            domain.addAllowedValue(lowest);
+            domain.addAllowedValue(highest);
+        }
+        for(std::size_t count : {0, 1, 63, 64, 65, 200, 1000}) {
+            std::vector<T> probes;
+            for(std::size_t i = 0; i < count; ++i) {
+                T probe = static_cast<T>(rng() % 600) - static_cast<T>(std::is_signed<T>::value ? 300 : 0);
+                probes.push_back(i % 7 == 0 ? lowest : i % 11 == 0 ? highest : probe);
+            }
+            agree(domain, probes);
+        }
+        //The sorted snapshot follows changes
+        if(!values.empty()) {
+            domain.removeAllowedValue(values[0]);
+            agree(domain, values);
+        }
+    }
+}
+
+int main() {
+    if(!supported()) {
+        std::puts("skipped: the CPU lacks the instruction set this test was built for");
+        return check::skipped;
+    }
+    testType<std::int8_t>();
+    testType<std::uint16_t>();
+    testType<std::int32_t>();
+    testType<std::uint32_t>();
+    testType<std::int64_t>();
+    testType<std::uint64_t>();
+    testType<std::int32_t, FlatStorage>();
+    testType<std::int64_t, HashStorage<>>();
+    return check::result();
+}
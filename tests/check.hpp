@@ -0,0 +1,32 @@
+#ifndef DRV_CHECK_HPP
+#define DRV_CHECK_HPP
+
+#include <cstdio>
+
+//Checks for the tests, kept in Release builds unlike assert: a failed CHECK
+//is reported and counted, and main returns check::result()
+namespace check {
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline int result() {
+    if(failures() != 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures());
+        return 1;
+    }
+    return 0;
+}
+
+//Returned by tests that do not apply to the machine they run on
+const int skipped = 77;
+
+}
+
+#define CHECK(condition) \
+    ((condition) ? (void)0 : (void)(std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", \
+        __FILE__, __LINE__, #condition), ++check::failures()))
+
+#endif
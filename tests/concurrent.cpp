@@ -0,0 +1,210 @@
+//The types meant for several threads, hammered by several threads. Built a
+//second time with ThreadSanitizer where the compiler has it.
+#include "check.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <string>
+#include <thread>
+
+const int thread_count = 4;
+
+template<class F>
+void onThreads(F f) {
+    std::vector<std::thread> threads;
+    for(int t = 0; t < thread_count; ++t) {
+        threads.emplace_back(f, t);
+    }
+    for(std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+using storage = ConcurrentStorage<>;
+using domain_type = VariableDomain<int, std::less<int>, storage>;
+
+//Every operation of a ConcurrentStorage domain and its variables at once,
+//with the lookup accelerators rebuilt under the readers' feet
+void testDomain() {
+    domain_type domain;
+    for(int i = 0; i < 500; ++i) {
+        domain.addAllowedValue(i);
+    }
+    domain.setLookupAcceleration(LookupAcceleration::eytzinger);
+    domain.enableBloomFilter();
+    std::atomic<int> notified(0);
+    domain.addListener([&](const DomainChanges<int>&) { ++notified; });
+
+    onThreads([&](int t) {
+        DomainRestrictedVariable<int, std::less<int>, storage> variable(domain);
+        LazyDomainRestrictedVariable<int, std::less<int>, storage> lazy(domain);
+        for(int i = 0; i < 3000; ++i) {
+            int value = (i * 7 + t) % 1000;
+            if(i % 10 == 0) {
+                if(t % 2 == 0) {
+                    domain.addAllowedValue(value);
+                } else {
+                    domain.removeAllowedValue(value);
+                }
+                domain.replaceAllowedValue(value + 1, value + 1);
+                continue;
+            }
+            variable = value;
+            lazy = value;
+            DomainRestrictedVariable<int, std::less<int>, storage> copy(variable);
+            copy = std::move(variable);
+            variable = copy;
+            (void)lazy.has_value();
+            (void)domain.useCount(value);
+            (void)domain.resolve(domain.makeRef(value));
+            std::uint64_t bits;
+            int values[3] = {value, value + 1, 5000};
+            domain.isAllowedValues(values, 3, &bits);
+            CHECK((bits & 4) == 0);
+        }
+    });
+    CHECK(notified.load() > 0);
+    std::vector<int> values = domain.allowedValues();
+    CHECK(std::is_sorted(values.begin(), values.end()));
+}
+
+//Snapshots stay whole while the domain changes, including past the 64
+//reader slots
+void testSnapshots() {
+    domain_type domain{1, 2, 3};
+    domain.enableSnapshots();
+    std::atomic<bool> done(false);
+    std::thread writer([&] {
+        for(int i = 0; i < 2000; ++i) {
+            domain.addAllowedValue(100 + i % 50);
+            domain.removeAllowedValue(100 + (i + 25) % 50);
+        }
+        done = true;
+    });
+    onThreads([&](int) {
+        while(!done) {
+            std::vector<DomainSnapshot<int, std::less<int>, storage>> held;
+            for(int k = 0; k < 20; ++k) {
+                held.push_back(domain.snapshot());
+            }
+            for(const auto& snapshot : held) {
+                CHECK(snapshot.isAllowedValue(2) && std::is_sorted(snapshot.begin(), snapshot.end()));
+            }
+        }
+    });
+    writer.join();
+}
+
+//A state machine 0 -> 1 -> 4 -> 0 driven by compare_exchange, while other
+//values come and go
+void testAtomicVariable() {
+    using atomic_type = AtomicDomainRestrictedVariable<int, std::less<int>, storage>;
+    static_assert(sizeof(atomic_type) == 8, "");
+    domain_type domain{0, 1, 2, 4};
+    atomic_type state(domain, 0);
+    CHECK(state.is_lock_free() && !atomic_type().load(domain).has_value());
+    CHECK(!state.compare_exchange(domain, 0, 9) && state.load(domain) == 0);
+    CHECK(state.exchange(domain, 2) == 0 && *domain.resolve(state.loadRef()) == 2);
+    state.store(domain, 0);
+
+    std::atomic<int> moves(0);
+    std::atomic<bool> done(false);
+    std::thread churn([&] {
+        for(int i = 0; i < 2000; ++i) {
+            domain.addAllowedValue(100 + i % 20);
+            domain.removeAllowedValue(100 + (i + 10) % 20);
+        }
+        done = true;
+    });
+    onThreads([&](int) {
+        const int next[5] = {1, 4, 0, 0, 0};
+        auto zero = domain.makeRef(0);
+        for(int i = 0; i < 5000 || !done; ++i) {
+            std::optional<int> current = state.load(domain);
+            CHECK(current.has_value());
+            if(current && state.compare_exchange(domain, *current, next[*current])) {
+                ++moves;
+            }
+            (void)state.compare_exchange(domain, zero, zero);
+        }
+    });
+    churn.join();
+    CHECK(moves.load() > 0);
+    std::optional<int> last = state.load(domain);
+    CHECK(last == 0 || last == 1 || last == 4);
+}
+
+//Values removed while other threads load and exchange them: the copies
+//handed out are whole, never read from freed memory
+void testAtomicRemoval() {
+    using string_domain = VariableDomain<std::string, std::less<std::string>, storage>;
+    const std::string prefix = "a value too long for the small string buffer ";
+    string_domain domain;
+    for(int i = 0; i < 16; ++i) {
+        domain.addAllowedValue(prefix + std::to_string(i));
+    }
+    AtomicDomainRestrictedVariable<std::string, std::less<std::string>, storage> state(domain, prefix + "0");
+
+    std::atomic<bool> done(false);
+    std::thread churn([&] {
+        for(int i = 0; i < 3000; ++i) {
+            std::string value = prefix + std::to_string(i % 16);
+            domain.removeAllowedValue(value);
+            domain.addAllowedValue(value);
+        }
+        done = true;
+    });
+    onThreads([&](int t) {
+        for(int i = 0; !done; ++i) {
+            std::optional<std::string> value = t % 2 == 0
+                ? state.load(domain)
+                : state.exchange(domain, prefix + std::to_string(i % 16));
+            CHECK(!value || value->compare(0, prefix.size(), prefix) == 0);
+            if(!value) {
+                state.store(domain, prefix + std::to_string(i % 16));
+            }
+        }
+    });
+    churn.join();
+}
+
+//Inserts from every thread, and values replaced back and forth between two
+//shards: each replacement moves the value or finds it gone, never both
+void testSharded() {
+    ShardedVariableDomain<int> domain(8);
+    onThreads([&](int t) {
+        for(int i = 0; i < 2000; ++i) {
+            domain.addAllowedValue(10000 + t * 2000 + i);
+            (void)domain.isAllowedValue(i);
+        }
+    });
+    CHECK(domain.allowedValues().size() == thread_count * 2000);
+
+    int a = 0, b = 1;
+    while(&domain.shardOf(a) == &domain.shardOf(b)) {
+        ++b;
+    }
+    domain.addAllowedValue(a);
+    onThreads([&](int t) {
+        for(int i = 0; i < 2000; ++i) {
+            if(t % 2 == 0) {
+                domain.replaceAllowedValue(a, b);
+            } else {
+                domain.replaceAllowedValue(b, a);
+            }
+        }
+    });
+    CHECK(domain.isAllowedValue(a) != domain.isAllowedValue(b));
+}
+
+int main() {
+    testDomain();
+    testSnapshots();
+    testAtomicVariable();
+    testAtomicRemoval();
+    testSharded();
+    return check::result();
+}
@@ -0,0 +1,89 @@
+//Freezing and thawing: lookups answer the same through the perfect hash,
+//mutators refuse while frozen, and comparators std::hash does not agree
+//with freeze through their CompareHash.
+#include "check.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <cctype>
+#include <stdexcept>
+#include <string>
+
+struct case_insensitive_less {
+    bool operator()(const std::string& lhs, const std::string& rhs) const {
+        return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+            [](char l, char r) { return std::tolower(l) < std::tolower(r); });
+    }
+};
+
+struct case_insensitive_hash {
+    std::size_t operator()(const std::string& value) const {
+        std::string lower(value);
+        for(char& c : lower) {
+            c = static_cast<char>(std::tolower(c));
+        }
+        return std::hash<std::string>()(lower);
+    }
+};
+
+template<>
+struct CompareHash<std::string, case_insensitive_less> {
+    using type = case_insensitive_hash;
+};
+
+template<class Storage>
+void testFreeze() {
+    VariableDomain<int, std::less<int>, Storage> domain;
+    for(int i = 0; i < 1000; i += 3) {
+        domain.addAllowedValue(i);
+    }
+    DomainRestrictedVariable<int, std::less<int>, Storage> variable(domain, 300);
+
+    domain.freeze();
+    CHECK(domain.isFrozen());
+    for(int i = -5; i < 1005; ++i) {
+        if(domain.isAllowedValue(i) != (i >= 0 && i < 1000 && i % 3 == 0)) {
+            CHECK(!"frozen lookup disagrees");
+            break;
+        }
+    }
+    CHECK(!domain.addAllowedValue(1));
+    CHECK(!domain.removeAllowedValue(3));
+    CHECK(!domain.replaceAllowedValue(3, 4));
+    bool threw = false;
+    try {
+        domain.removeAllowedValues({3, 6});
+    } catch(const std::logic_error&) {
+        threw = true;
+    }
+    CHECK(threw && domain.isAllowedValue(3));
+
+    //Assignments go through the perfect hash too
+    variable = 999;
+    CHECK(variable.value() == 999);
+    variable = 998;
+    CHECK(!variable.has_value());
+
+    domain.thaw();
+    CHECK(!domain.isFrozen());
+    CHECK(domain.addAllowedValue(1) && domain.isAllowedValue(1));
+    CHECK(domain.removeAllowedValue(3) && !domain.isAllowedValue(3));
+    domain.freeze();
+    CHECK(domain.isAllowedValue(1) && !domain.isAllowedValue(3));
+}
+
+void testCompareHash() {
+    VariableDomain<std::string, case_insensitive_less> domain{"Idle", "Busy"};
+    domain.freeze();
+    CHECK(domain.isAllowedValue("idle") && domain.isAllowedValue("BUSY"));
+    CHECK(!domain.isAllowedValue("gone"));
+}
+
+int main() {
+    testFreeze<SetStorage>();
+    testFreeze<FlatStorage>();
+    testFreeze<HashStorage<>>();
+    testFreeze<SmallStorage<8>>();
+    testCompareHash();
+    return check::result();
+}
@@ -0,0 +1,43 @@
+//Interned strings: the domain keeps its own copy of every value, and views
+//of the caller's buffers never end up in it.
+#include "check.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <string>
+#include <string_view>
+
+void testCopies() {
+    InternedStringDomain colors;
+    std::string buffer = "red";
+    CHECK(colors.addAllowedValue(buffer) && !colors.addAllowedValue("red"));
+    InternedStringVariable color(colors, buffer);
+    buffer = "xyz";
+    CHECK(color.value() == "red" && color.value().data() != buffer.data());
+    CHECK(colors.isAllowedValue(std::string_view("red")) && !colors.isAllowedValue(buffer));
+}
+
+void testChanges() {
+    InternedStringDomain colors{"red", "green"};
+    InternedStringVariable first(colors, "red");
+    InternedStringVariable second(colors, std::string("red"));
+    InternedStringVariable other(colors, "green");
+    CHECK(first == second && first != other);
+    CHECK(first.value().data() == second.value().data());
+
+    CHECK(colors.replaceAllowedValue("red", "crimson"));
+    CHECK(first.value() == "crimson" && !colors.isAllowedValue("red"));
+    CHECK(colors.removeAllowedValue("green") && !other.has_value());
+
+    //Many values, so that the arena grows past a chunk
+    for(int i = 0; i < 10000; ++i) {
+        colors.addAllowedValue("color " + std::to_string(i));
+    }
+    CHECK(colors.isAllowedValue("color 9999") && first.value() == "crimson");
+}
+
+int main() {
+    testCopies();
+    testChanges();
+    return check::result();
+}
@@ -0,0 +1,75 @@
+//Listeners hear about each mutation once, and about a whole batch at once.
+#include "check.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+using domain_type = VariableDomain<int>;
+
+struct recorder {
+    std::vector<DomainChanges<int>> calls;
+
+    explicit recorder(domain_type& domain) {
+        domain.addListener([this](const DomainChanges<int>& changes) { calls.push_back(changes); });
+    }
+};
+
+void testSingleChanges() {
+    domain_type domain{1, 2};
+    recorder heard(domain);
+    domain.addAllowedValue(3);
+    domain.removeAllowedValue(1);
+    domain.replaceAllowedValue(2, 4);
+    domain.addAllowedValue(3);
+    CHECK(heard.calls.size() == 3);
+    CHECK(heard.calls[0].added == std::vector<int>{3});
+    CHECK(heard.calls[1].removed == std::vector<int>{1});
+    CHECK(heard.calls[2].replaced.size() == 1 && heard.calls[2].replaced[0] == std::make_pair(2, 4));
+}
+
+void testBatches() {
+    domain_type domain{1, 2, 3};
+    recorder heard(domain);
+
+    domain.beginChangeBatch();
+    for(int i = 10; i < 20; ++i) {
+        domain.addAllowedValue(i);
+    }
+    domain.removeAllowedValue(1);
+    //Batches nest, and only the outermost one notifies
+    domain.beginChangeBatch();
+    domain.replaceAllowedValue(2, 5);
+    domain.removeAllowedValues({10, 11});
+    domain.endChangeBatch();
+    CHECK(heard.calls.empty());
+    domain.endChangeBatch();
+
+    CHECK(heard.calls.size() == 1);
+    const DomainChanges<int>& changes = heard.calls.back();
+    CHECK(changes.added.size() == 10);
+    CHECK((changes.removed == std::vector<int>{1, 10, 11}));
+    CHECK(changes.replaced.size() == 1 && changes.replaced[0] == std::make_pair(2, 5));
+
+    //A batch that changed nothing stays quiet
+    domain.beginChangeBatch();
+    domain.addAllowedValue(3);
+    domain.endChangeBatch();
+    CHECK(heard.calls.size() == 1);
+}
+
+void testRemoval() {
+    domain_type domain{1};
+    int first = 0, second = 0;
+    std::size_t id = domain.addListener([&](const DomainChanges<int>&) { ++first; });
+    domain.addListener([&](const DomainChanges<int>&) { ++second; });
+    domain.addAllowedValue(2);
+    CHECK(domain.removeListener(id) && !domain.removeListener(id));
+    domain.addAllowedValue(3);
+    CHECK(first == 1 && second == 2);
+}
+
+int main() {
+    testSingleChanges();
+    testBatches();
+    testRemoval();
+    return check::result();
+}
@@ -0,0 +1,133 @@
+//Lookup acceleration and the Bloom filter have to answer exactly as the
+//plain storage does, for every size of domain and after every change.
+#include "check.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <random>
+#include <set>
+#include <string>
+
+//The domain's answers for -1..range against the values it was given
+template<class Domain>
+bool agrees(const Domain& domain, const std::set<int>& values, int range) {
+    for(int i = -1; i <= range; ++i) {
+        if(domain.isAllowedValue(i) != (values.count(i) != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<class Storage, class Compare>
+void testEytzinger() {
+    std::mt19937 rng(7);
+    for(int size : {0, 1, 2, 7, 100, 5000}) {
+        VariableDomain<int, Compare, Storage> domain;
+        domain.setLookupAcceleration(LookupAcceleration::eytzinger);
+        CHECK(domain.lookupAcceleration() == LookupAcceleration::eytzinger);
+        std::set<int> values;
+        for(int i = 0; i < size; ++i) {
+            int value = static_cast<int>(rng() % static_cast<unsigned>(2 * size));
+            domain.addAllowedValue(value);
+            values.insert(value);
+        }
+        CHECK(agrees(domain, values, 2 * size));
+
+        //The layout is rebuilt after changes
+        if(size > 0) {
+            domain.removeAllowedValue(*values.begin());
+            values.erase(values.begin());
+            domain.addAllowedValue(-1);
+            values.insert(-1);
+            CHECK(agrees(domain, values, 2 * size));
+        }
+    }
+}
+
+void testStrings() {
+    VariableDomain<std::string> domain{"b", "d", "f"};
+    domain.setLookupAcceleration(LookupAcceleration::eytzinger);
+    CHECK(domain.isAllowedValue("d") && !domain.isAllowedValue("c") && !domain.isAllowedValue("g"));
+    DomainRestrictedVariable<std::string> variable(domain, "f");
+    CHECK(variable.value() == "f");
+    domain.setLookupAcceleration(LookupAcceleration::none);
+    CHECK(domain.isAllowedValue("b"));
+}
+
+template<class Storage>
+void testBloom() {
+    VariableDomain<int, std::less<int>, Storage> domain;
+    domain.enableBloomFilter(0.01);
+    CHECK(domain.isBloomFilterEnabled());
+    std::set<int> values;
+    for(int i = 0; i < 2000; i += 2) {
+        domain.addAllowedValue(i);
+        values.insert(i);
+    }
+    CHECK(agrees(domain, values, 4000));
+    BloomFilterStats stats = domain.bloomFilterStats();
+    CHECK(stats.hits == 1000 && stats.rejected + stats.misses == 3002);
+    CHECK(stats.misses < 300);
+
+    //Removals rebuild the filter, added values are fed to it
+    domain.removeAllowedValue(0);
+    values.erase(0);
+    for(int i = 1; i < 6000; i += 2) {
+        domain.addAllowedValue(i);
+        values.insert(i);
+    }
+    CHECK(agrees(domain, values, 8000));
+
+    domain.resetBloomFilterStats();
+    CHECK(domain.bloomFilterStats().hits == 0);
+    domain.disableBloomFilter();
+    CHECK(!domain.isBloomFilterEnabled() && agrees(domain, values, 8000));
+}
+
+struct case_insensitive_less {
+    bool operator()(const std::string& lhs, const std::string& rhs) const {
+        return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+            [](char l, char r) { return std::tolower(l) < std::tolower(r); });
+    }
+};
+
+struct case_insensitive_hash {
+    std::size_t operator()(const std::string& value) const {
+        std::string lower(value);
+        for(char& c : lower) {
+            c = static_cast<char>(std::tolower(c));
+        }
+        return std::hash<std::string>()(lower);
+    }
+};
+
+template<>
+struct CompareHash<std::string, case_insensitive_less> {
+    using type = case_insensitive_hash;
+};
+
+//The filter hashes through CompareHash, so equivalent spellings pass it
+void testBloomCompareHash() {
+    VariableDomain<std::string, case_insensitive_less> domain{"Idle", "Busy"};
+    domain.enableBloomFilter(0.01);
+    domain.addAllowedValue("Gone");
+    CHECK(domain.isAllowedValue("GONE") && domain.isAllowedValue("idle"));
+    CHECK(!domain.isAllowedValue("done"));
+}
+
+int main() {
+    testEytzinger<SetStorage, std::less<int>>();
+    testEytzinger<FlatStorage, std::less<int>>();
+    testEytzinger<SetStorage, std::greater<int>>();
+    testEytzinger<HashStorage<>, std::less<int>>();
+    testStrings();
+    testBloom<SetStorage>();
+    testBloom<FlatStorage>();
+    testBloom<HashStorage<>>();
+    testBloomCompareHash();
+    return check::result();
+}
@@ -0,0 +1,36 @@
+//Per-request domains in a std::pmr arena: the domain, its values and its
+//variables' bookkeeping all come from the resource it was given, and
+//nothing reaches the default resource.
+#include "check.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <memory_resource>
+#include <string>
+
+void testArena() {
+    std::byte buffer[65536];
+    std::pmr::monotonic_buffer_resource arena(
+        buffer, sizeof(buffer), std::pmr::null_memory_resource());
+    //Anything reaching either would throw std::bad_alloc
+    std::pmr::memory_resource* previous =
+        std::pmr::set_default_resource(std::pmr::null_memory_resource());
+    {
+        PmrVariableDomain<std::pmr::string> domain(&arena);
+        for(int i = 0; i < 50; ++i) {
+            std::pmr::string value("a value too long for the small string buffer", &arena);
+            value += std::to_string(i).c_str();
+            domain.addAllowedValue(value);
+        }
+        std::pmr::string held("a value too long for the small string buffer7", &arena);
+        PmrDomainRestrictedVariable<std::pmr::string> variable(domain, held);
+        CHECK(variable.has_value() && domain.useCount(held) == 1);
+        CHECK(domain.removeAllowedValue(held) && !variable.has_value());
+    }
+    std::pmr::set_default_resource(previous);
+}
+
+int main() {
+    testArena();
+    return check::result();
+}
@@ -0,0 +1,34 @@
+//Compile-time domains: contains() in constant expressions, literals, and a
+//domain that stays frozen whatever is asked of it.
+#include "check.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+using HttpStatus = StaticVariableDomain<int, 200, 404, 500>;
+
+static_assert(HttpStatus::contains(404) && !HttpStatus::contains(403), "");
+static_assert(HttpStatus::literal<500>() == 500, "");
+
+void testDomain() {
+    HttpStatus domain;
+    CHECK(domain.isFrozen());
+    CHECK(domain.isAllowedValue(200) && !domain.isAllowedValue(201));
+    domain.thaw();
+    CHECK(domain.isFrozen() && !domain.addAllowedValue(201));
+    CHECK(!domain.removeAllowedValue(200) && domain.isAllowedValue(200));
+}
+
+void testVariable() {
+    HttpStatus domain;
+    DomainRestrictedVariable<int, std::less<int>, HttpStatus::storage_policy> status(domain);
+    status = HttpStatus::literal<404>();
+    CHECK(status.value() == 404);
+    status = 403;
+    CHECK(!status.has_value());
+}
+
+int main() {
+    testDomain();
+    testVariable();
+    return check::result();
+}
@@ -0,0 +1,187 @@
+//Every storage policy goes through the same additions, removals and
+//replacements, with eager and lazy variables, references and a listener
+//watching.
+#include "check.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <algorithm>
+#include <map>
+
+template<class Storage>
+class storage_test {
+    public:
+    using domain_type = VariableDomain<int, std::less<int>, Storage>;
+    using variable_type = DomainRestrictedVariable<int, std::less<int>, Storage>;
+    using lazy_type = LazyDomainRestrictedVariable<int, std::less<int>, Storage>;
+
+    storage_test(): m_domain{1, 2, 3}, m_calls(0), m_changes() {
+        m_domain.addListener([this](const DomainChanges<int>& changes) {
+            ++m_calls;
+            m_changes = changes;
+        });
+    }
+
+    void run() {
+        additions();
+        removals();
+        replacements();
+        ranges();
+    }
+
+    private:
+    domain_type m_domain;
+    int m_calls;
+    DomainChanges<int> m_changes;
+
+    void additions() {
+        CHECK(m_domain.addAllowedValue(4));
+        CHECK(m_calls == 1 && m_changes.added == std::vector<int>{4});
+        CHECK(!m_domain.addAllowedValue(4));
+        CHECK(m_calls == 1);
+        CHECK(m_domain.isAllowedValue(4) && !m_domain.isAllowedValue(5));
+
+        std::vector<int> values = m_domain.allowedValues();
+        std::sort(values.begin(), values.end());
+        CHECK((values == std::vector<int>{1, 2, 3, 4}));
+    }
+
+    void removals() {
+        variable_type eager(m_domain, 4);
+        lazy_type lazy(m_domain);
+        lazy = 4;
+        auto ref = m_domain.makeRef(4);
+        CHECK(eager.has_value() && lazy.has_value() && m_domain.resolve(ref) != nullptr);
+        CHECK(m_domain.useCount(4) == 1);
+        CHECK(!m_domain.removeAllowedValueIfUnused(4));
+
+        CHECK(m_domain.removeAllowedValue(4));
+        CHECK(m_calls == 2 && m_changes.removed == std::vector<int>{4});
+        CHECK(!eager.has_value() && !lazy.has_value() && m_domain.resolve(ref) == nullptr);
+        CHECK(!m_domain.isAllowedValue(4) && m_domain.useCount(4) == 0);
+        CHECK(!m_domain.removeAllowedValue(4));
+        CHECK(m_calls == 2);
+    }
+
+    void replacements() {
+        variable_type eager(m_domain, 3);
+        variable_type other(m_domain, 2);
+        lazy_type lazy(m_domain);
+        lazy = 3;
+        auto ref = m_domain.makeRef(3);
+
+        CHECK(m_domain.replaceAllowedValue(3, 7));
+        CHECK(m_calls == 3 && m_changes.replaced.size() == 1);
+        CHECK(m_changes.replaced[0] == std::make_pair(3, 7));
+        CHECK(eager.value() == 7 && lazy.value() == 7 && *m_domain.resolve(ref) == 7);
+        CHECK(!m_domain.isAllowedValue(3) && m_domain.isAllowedValue(7));
+        CHECK(m_domain.useCount(7) == 1);
+
+        //Onto a value that is held too: the holders of both end up together
+        CHECK(m_domain.replaceAllowedValue(7, 2));
+        CHECK(eager.value() == 2 && other.value() == 2 && lazy.value() == 2);
+        CHECK(m_domain.useCount(2) == 2);
+        CHECK(!m_domain.replaceAllowedValue(7, 8));
+    }
+
+    void ranges() {
+        int calls = m_calls;
+        std::vector<int> added = {10, 11, 12, 13};
+        m_domain.addAllowedValuesRange(added.begin(), added.end());
+        CHECK(m_calls == calls + 1 && m_changes.added.size() == 4);
+
+        variable_type eager(m_domain, 11);
+        m_domain.removeAllowedValues({10, 11});
+        CHECK(m_calls == calls + 2 && m_changes.removed.size() == 2);
+        CHECK(!eager.has_value());
+
+        eager = 12;
+        std::map<int, int> remap = {{12, 14}, {13, 15}};
+        m_domain.replaceAllowedValuesRange(remap.begin(), remap.end());
+        CHECK(m_calls == calls + 3 && m_changes.replaced.size() == 2);
+        CHECK(eager.value() == 14 && m_domain.isAllowedValue(15) && !m_domain.isAllowedValue(13));
+    }
+};
+
+template<class Storage>
+void testStorage() {
+    storage_test<Storage> test;
+    test.run();
+}
+
+//Ranges of values, with the interval mutators on top
+void testIntervals() {
+    using domain_type = VariableDomain<int, std::less<int>, IntervalStorage>;
+    domain_type domain;
+    std::vector<DomainChanges<int>> calls;
+    domain.addListener([&](const DomainChanges<int>& changes) { calls.push_back(changes); });
+
+    CHECK(domain.addAllowedInterval(100, 199));
+    CHECK(domain.isAllowedValue(150) && !domain.isAllowedValue(200));
+    DomainRestrictedVariable<int, std::less<int>, IntervalStorage> inside(domain, 150);
+    DomainRestrictedVariable<int, std::less<int>, IntervalStorage> outside(domain, 190);
+    CHECK(domain.removeAllowedInterval(140, 160));
+    CHECK(!inside.has_value() && outside.value() == 190);
+    CHECK(calls.size() == 2);
+    CHECK(calls[0].added_intervals.size() == 1 && calls[1].removed_intervals.size() == 1);
+}
+
+//Lookups and use counts inside a wide interval leave it alone: only the
+//values something points at get stored
+void testIntervalLookups() {
+    using counting = CountingAllocator<int>;
+    AllocationCounts counts = AllocationCounts();
+    VariableDomain<int, std::less<int>, IntervalStorage, counting> domain((counting(counts)));
+    domain.addAllowedInterval(0, 1000000);
+    std::size_t before = counts.allocations;
+    for(int i = 0; i < 1000; ++i) {
+        if(!domain.isAllowedValue(i) || domain.useCount(i) != 0) {
+            CHECK(!"lookup inside the interval failed");
+            break;
+        }
+    }
+    CHECK(domain.useCount(-5) == 0 && domain.makeRef(-1).is_null());
+    CHECK(counts.allocations == before);
+
+    DomainRestrictedVariable<int, std::less<int>, IntervalStorage, counting> variable(domain, 7);
+    CHECK(variable.value() == 7 && domain.useCount(7) == 1);
+    auto ref = domain.makeRef(500);
+    CHECK(*domain.resolve(ref) == 500 && domain.resolve(domain.makeRef(500)) == domain.resolve(ref));
+    CHECK(domain.removeAllowedValue(500) && domain.resolve(ref) == nullptr);
+    CHECK(domain.removeAllowedValue(600) && !domain.isAllowedValue(600));
+    CHECK(domain.replaceAllowedValue(602, -10) && domain.isAllowedValue(-10));
+    CHECK(!domain.isAllowedValue(602));
+}
+
+#if __cplusplus >= 201402L
+//Keys wider than the window's type are compared before they are narrowed
+void testBitsetKeys() {
+    VariableDomain<int, std::less<int>, BitsetStorage<0, 1023>> domain{5};
+    CHECK(domain.isAllowedValue(5LL) && domain.isAllowedValue(5ULL));
+    CHECK(!domain.isAllowedValue((1LL << 32) + 5) && !domain.isAllowedValue(-(1LL << 32) + 5));
+    CHECK(!domain.isAllowedValue((1ULL << 63) + 5));
+
+    VariableDomain<unsigned char, std::less<unsigned char>, BitsetStorage<0, 255>> bytes{5};
+    CHECK(bytes.isAllowedValue(5) && !bytes.isAllowedValue(261) && !bytes.isAllowedValue(-251));
+}
+#endif
+
+int main() {
+    testStorage<SetStorage>();
+    testStorage<FlatStorage>();
+    testStorage<HashStorage<>>();
+    testStorage<BitsetStorage<0, 1023>>();
+    testStorage<IntervalStorage>();
+    testStorage<SmallStorage<4>>();
+    testStorage<SmallStorage<2, FlatStorage>>();
+#if __cplusplus >= 201703L
+    testStorage<ConcurrentStorage<>>();
+    testStorage<ConcurrentStorage<HashStorage<>>>();
+#endif
+#if __cplusplus >= 201402L
+    testBitsetKeys();
+#endif
+    testIntervals();
+    testIntervalLookups();
+    return check::result();
+}
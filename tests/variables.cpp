@@ -0,0 +1,161 @@
+//Variables and the domain keeping them in step: each value knows its
+//holders, so a change only reaches the variables it concerns.
+#include "check.hpp"
+
+#include <domain_restricted_variable.hpp>
+
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using domain_type = VariableDomain<int>;
+using variable_type = DomainRestrictedVariable<int>;
+
+void testReverseIndex() {
+    domain_type domain{1, 2, 3};
+    std::vector<variable_type> variables;
+    for(int i = 0; i < 30; ++i) {
+        variables.emplace_back(domain, i % 3 + 1);
+    }
+
+    CHECK(domain.removeAllowedValue(2));
+    CHECK(domain.replaceAllowedValue(3, 4));
+    for(int i = 0; i < 30; ++i) {
+        const variable_type& variable = variables[static_cast<std::size_t>(i)];
+        bool right = i % 3 == 0 ? variable.value() == 1
+            : i % 3 == 1 ? !variable.has_value()
+            : variable.value() == 4;
+        if(!right) {
+            CHECK(!"a variable was touched by a change to another value");
+            break;
+        }
+    }
+
+    //A cleared variable holds nothing any more, and is assignable again
+    variables[1] = 1;
+    CHECK(variables[1].value() == 1);
+}
+
+//Lazy variables find out about changes when they are read
+void testLazy() {
+    using lazy_type = LazyDomainRestrictedVariable<int>;
+    domain_type domain{1, 2, 3};
+    std::vector<lazy_type> lazies(1000, lazy_type(domain, 1));
+    lazy_type other(domain, 2);
+    lazy_type empty(domain);
+    CHECK(!empty.has_value() && domain.useCount(1) == 0);
+
+    CHECK(domain.replaceAllowedValue(1, 5));
+    CHECK(lazies[0].value() == 5 && lazies[999].value() == 5);
+    CHECK(domain.removeAllowedValue(5));
+    CHECK(!lazies[0].has_value() && other.value() == 2);
+
+    //Coming back is a new value as far as they are concerned
+    domain.addAllowedValue(5);
+    CHECK(!lazies[0].has_value());
+    lazies[0] = 5;
+    CHECK(lazies[0].value() == 5);
+    lazies[0] = 7;
+    CHECK(!lazies[0].has_value());
+}
+
+void testBatches() {
+    domain_type domain{1, 2, 3, 4, 5};
+    variable_type one(domain, 1), two(domain, 2), three(domain, 3), five(domain, 5);
+
+    //Values outside of the domain are skipped
+    std::vector<int> removed = {2, 3, 9};
+    domain.removeAllowedValuesRange(removed.begin(), removed.end());
+    CHECK(!two.has_value() && !three.has_value() && one.value() == 1);
+    CHECK(!domain.isAllowedValue(2) && !domain.isAllowedValue(3));
+
+    //The pairs apply in order, so 1 -> 6 -> 7 takes the holders of 1 along
+    domain.replaceAllowedValues({{1, 6}, {6, 7}, {5, 4}});
+    CHECK(one.value() == 7 && five.value() == 4);
+    CHECK(domain.useCount(4) == 1 && domain.useCount(7) == 1);
+    CHECK(!domain.isAllowedValue(1) && !domain.isAllowedValue(6) && !domain.isAllowedValue(5));
+}
+
+void testUsage() {
+    domain_type domain{1, 2, 3};
+    variable_type first(domain, 1);
+    {
+        variable_type copy(first);
+        variable_type moved(std::move(copy));
+        CHECK(domain.useCount(1) == 2);
+        variable_type second(domain, 2);
+        second.clear();
+        CHECK(domain.useCount(2) == 0);
+    }
+    CHECK(domain.useCount(1) == 1 && domain.useCount(9) == 0);
+    LazyDomainRestrictedVariable<int> lazy(domain, 3);
+    CHECK(domain.useCount(3) == 0);
+
+    variable_type third(domain, 3);
+    std::vector<std::pair<int, std::size_t>> counts = domain.useCounts();
+    std::sort(counts.begin(), counts.end());
+    CHECK((counts == std::vector<std::pair<int, std::size_t>>{{1, 1}, {3, 1}}));
+    CHECK(domain.unusedValues() == std::vector<int>{2});
+
+    CHECK(!domain.removeAllowedValueIfUnused(1) && domain.isAllowedValue(1));
+    CHECK(domain.removeAllowedValueIfUnused(2) && !domain.isAllowedValue(2));
+    CHECK(!domain.removeAllowedValueIfUnused(2));
+}
+
+//Replacing onto a held value merges the two holder lists, whichever is
+//the larger
+void testMerge() {
+    domain_type domain{1, 2, 3};
+    std::vector<variable_type> many(100, variable_type(domain, 1));
+    variable_type few(domain, 2);
+    variable_type other(domain, 3);
+
+    CHECK(domain.replaceAllowedValue(1, 2));
+    CHECK(domain.useCount(2) == 101 && few.value() == 2 && many[99].value() == 2);
+    CHECK(domain.replaceAllowedValue(3, 2));
+    CHECK(other.value() == 2 && domain.useCount(2) == 102 && !domain.isAllowedValue(3));
+
+    //Merged lists keep working as one
+    variable_type late(domain, 2);
+    CHECK(domain.useCount(2) == 103);
+    CHECK(domain.removeAllowedValue(2));
+    CHECK(!many[0].has_value() && !few.has_value() && !other.has_value() && !late.has_value());
+}
+
+//References hold no subscription: they are trivially copyable, 8 bytes,
+//and find out about changes from the domain when resolved
+void testRefs() {
+    using ref_type = DomainValueRef<int>;
+    static_assert(sizeof(ref_type) == 8, "");
+    static_assert(std::is_trivially_copyable<ref_type>::value, "");
+
+    domain_type domain{1, 2, 3};
+    CHECK(ref_type().is_null() && domain.resolve(ref_type()) == nullptr);
+    CHECK(domain.makeRef(9).is_null());
+
+    std::vector<ref_type> refs(1000, domain.makeRef(1));
+    ref_type other = domain.makeRef(2);
+    CHECK(*domain.resolve(refs[0]) == 1 && *domain.resolve(other) == 2);
+    CHECK(domain.useCount(1) == 0);
+
+    CHECK(domain.replaceAllowedValue(1, 5));
+    CHECK(*domain.resolve(refs[999]) == 5);
+    CHECK(domain.removeAllowedValue(5));
+    CHECK(domain.resolve(refs[0]) == nullptr && *domain.resolve(other) == 2);
+
+    //The slot of a removed value is reused, but not its generation
+    domain.addAllowedValue(7);
+    ref_type fresh = domain.makeRef(7);
+    CHECK(*domain.resolve(fresh) == 7 && domain.resolve(refs[0]) == nullptr);
+}
+
+int main() {
+    testReverseIndex();
+    testLazy();
+    testBatches();
+    testUsage();
+    testMerge();
+    testRefs();
+    return check::result();
+}